@@ -0,0 +1,74 @@
+#include <algorithm>
+
+#include <stdint.h>
+
+#include "arena.hpp"
+
+Arena::Arena(size_t block_size)
+    : pos(nullptr),
+    end(nullptr),
+    block_size(block_size),
+    used_(0),
+    high_water_(0)
+{
+}
+
+void Arena::add_block(size_t size) {
+    Block block;
+    block.data.reset(new char[size]);
+    block.size = size;
+
+    pos = block.data.get();
+    end = pos + size;
+
+    blocks.push_back(std::move(block));
+}
+
+void *Arena::allocate(size_t size, size_t align) {
+    uintptr_t p = ((uintptr_t)pos + align - 1) & ~(uintptr_t)(align - 1);
+
+    if (!pos || p > (uintptr_t)end || size > (uintptr_t)end - p) {
+        // Large objects get a block of their own
+        add_block(std::max(block_size, size + align));
+
+        p = ((uintptr_t)pos + align - 1) & ~(uintptr_t)(align - 1);
+    }
+
+    pos = (char *)(p + size);
+    used_ += size;
+
+    return (void *)p;
+}
+
+void Arena::reset() {
+    high_water_ = std::max(high_water_, used_);
+    used_ = 0;
+
+    if (blocks.empty())
+        return;
+
+    if (blocks.size() > 1) {
+        size_t total = capacity();
+
+        blocks.clear();
+        add_block(total <= LINE_ARENA_MAX_RETAINED ? total : block_size);
+        return;
+    }
+
+    if (blocks[0].size > LINE_ARENA_MAX_RETAINED) {
+        blocks.clear();
+        pos = end = nullptr;
+        return;
+    }
+
+    pos = blocks[0].data.get();
+}
+
+size_t Arena::capacity() const {
+    size_t total = 0;
+
+    for (const Block &block: blocks)
+        total += block.size;
+
+    return total;
+}
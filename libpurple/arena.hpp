@@ -0,0 +1,158 @@
+#pragma once
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include <stddef.h>
+
+#include "constants.hpp"
+
+// Monotonic allocator for objects that all die at the same time, such as everything decoded from
+// one response. Allocating is a pointer bump, freeing single objects does nothing, and reset()
+// frees everything at once.
+class Arena {
+
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    char *pos;
+    char *end;
+
+    size_t block_size;
+
+    // Bytes handed out since the last reset, and the most at any reset
+    size_t used_;
+    size_t high_water_;
+
+    void add_block(size_t size);
+
+public:
+
+    explicit Arena(size_t block_size=LINE_ARENA_BLOCK_SIZE);
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t size, size_t align);
+
+    // Invalidates everything allocated so far. If the last round needed more than one block, they
+    // are merged into one big enough for it, up to LINE_ARENA_MAX_RETAINED bytes.
+    void reset();
+
+    size_t used() const { return used_; }
+    size_t high_water() const { return high_water_; }
+    size_t capacity() const;
+
+};
+
+// Standard allocator on top of an Arena, for containers that only live as long as it. Without an
+// arena it uses the heap.
+template <typename T>
+class ArenaAllocator {
+
+public:
+
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    Arena *arena;
+
+    ArenaAllocator(Arena *arena=nullptr) : arena(arena) { }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) { }
+
+    T *allocate(size_t n) {
+        if (n > (size_t)-1 / sizeof(T))
+            throw std::bad_alloc();
+
+        if (!arena)
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+
+        return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t) {
+        if (!arena)
+            ::operator delete(p);
+    }
+
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.arena == b.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.arena != b.arena;
+}
+
+// Allocator that keeps freed single objects on a free list instead of returning them to the heap,
+// for small objects that come and go all the time. The list is shared by everything allocated with
+// the same type and only grows to the most that were alive at once. Main loop only.
+template <typename T>
+class RecyclingAllocator {
+
+    struct Node {
+        Node *next;
+    };
+
+    static Node *&free_list() {
+        static Node *head = nullptr;
+        return head;
+    }
+
+public:
+
+    using value_type = T;
+
+    RecyclingAllocator() { }
+
+    template <typename U>
+    RecyclingAllocator(const RecyclingAllocator<U> &) { }
+
+    T *allocate(size_t n) {
+        if (n == 1 && free_list()) {
+            Node *node = free_list();
+            free_list() = node->next;
+            return reinterpret_cast<T *>(node);
+        }
+
+        if (n > (size_t)-1 / sizeof(T))
+            throw std::bad_alloc();
+
+        return static_cast<T *>(::operator new(
+            (n * sizeof(T) < sizeof(Node)) ? sizeof(Node) : n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        if (n != 1) {
+            ::operator delete(p);
+            return;
+        }
+
+        Node *node = reinterpret_cast<Node *>(p);
+        node->next = free_list();
+        free_list() = node;
+    }
+
+};
+
+template <typename T, typename U>
+bool operator==(const RecyclingAllocator<T> &, const RecyclingAllocator<U> &) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const RecyclingAllocator<T> &, const RecyclingAllocator<U> &) {
+    return false;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <stddef.h>
+
+// Inline storage used by Callback by default. Fits the lambdas in this plugin that capture this, a
+// couple of strings and a std::function.
+constexpr size_t CALLBACK_INLINE_SIZE = 80;
+
+// Move-only replacement for std::function that keeps callables of up to Size bytes inline instead
+// of on the heap. Anything bigger, or that can't be moved without throwing, still goes on the heap.
+template <typename Signature, size_t Size = CALLBACK_INLINE_SIZE>
+class Callback;
+
+template <typename R, typename... Args, size_t Size>
+class Callback<R(Args...), Size> {
+
+    struct Ops {
+        R (*invoke)(void *storage, Args... args);
+        void (*move)(void *dest, void *src);
+        void (*destroy)(void *storage);
+    };
+
+    template <typename F>
+    struct InlineOps {
+        static R invoke(void *storage, Args... args) {
+            return (*static_cast<F *>(storage))(std::forward<Args>(args)...);
+        }
+
+        static void move(void *dest, void *src) {
+            new (dest) F(std::move(*static_cast<F *>(src)));
+            static_cast<F *>(src)->~F();
+        }
+
+        static void destroy(void *storage) {
+            static_cast<F *>(storage)->~F();
+        }
+
+        static const Ops *get() {
+            static const Ops ops = { &invoke, &move, &destroy };
+            return &ops;
+        }
+    };
+
+    template <typename F>
+    struct HeapOps {
+        static R invoke(void *storage, Args... args) {
+            return (**static_cast<F **>(storage))(std::forward<Args>(args)...);
+        }
+
+        static void move(void *dest, void *src) {
+            *static_cast<F **>(dest) = *static_cast<F **>(src);
+        }
+
+        static void destroy(void *storage) {
+            delete *static_cast<F **>(storage);
+        }
+
+        static const Ops *get() {
+            static const Ops ops = { &invoke, &move, &destroy };
+            return &ops;
+        }
+    };
+
+    typename std::aligned_storage<Size, alignof(void *)>::type storage;
+    const Ops *ops;
+
+public:
+
+    template <typename F>
+    static constexpr bool stored_inline() {
+        return sizeof(F) <= Size
+            && alignof(F) <= alignof(void *)
+            && std::is_nothrow_move_constructible<F>::value;
+    }
+
+    Callback() : ops(nullptr) { }
+    Callback(std::nullptr_t) : ops(nullptr) { }
+
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Callback>::value>::type>
+    Callback(F &&f) : ops(nullptr) {
+        assign<typename std::decay<F>::type>(std::forward<F>(f));
+    }
+
+    Callback(Callback &&other) noexcept : ops(other.ops) {
+        if (ops) {
+            ops->move(&storage, &other.storage);
+            other.ops = nullptr;
+        }
+    }
+
+    Callback &operator=(Callback &&other) noexcept {
+        if (this != &other) {
+            reset();
+
+            if (other.ops) {
+                other.ops->move(&storage, &other.storage);
+                ops = other.ops;
+                other.ops = nullptr;
+            }
+        }
+
+        return *this;
+    }
+
+    Callback(const Callback &) = delete;
+    Callback &operator=(const Callback &) = delete;
+
+    ~Callback() { reset(); }
+
+    void reset() {
+        if (ops) {
+            ops->destroy(&storage);
+            ops = nullptr;
+        }
+    }
+
+    explicit operator bool() const { return ops != nullptr; }
+
+    R operator()(Args... args) const {
+        return ops->invoke(const_cast<void *>(static_cast<const void *>(&storage)),
+            std::forward<Args>(args)...);
+    }
+
+private:
+
+    template <typename F, typename Arg>
+    typename std::enable_if<stored_inline<F>()>::type assign(Arg &&f) {
+        new (&storage) F(std::forward<Arg>(f));
+        ops = InlineOps<F>::get();
+    }
+
+    template <typename F, typename Arg>
+    typename std::enable_if<!stored_inline<F>()>::type assign(Arg &&f) {
+        *reinterpret_cast<F **>(&storage) = new F(std::forward<Arg>(f));
+        ops = HeapOps<F>::get();
+    }
+
+};
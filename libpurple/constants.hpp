@@ -14,9 +14,80 @@
 #define LINE_POLL_PATH "/P4"
 #define LINE_SHOP_PATH "/SHOP4"
 
+// Number of parallel connections for commands, and the maximum number of requests kept on the
+// wire at once on each of them
+#define LINE_COMMAND_LANES 3
+#define LINE_PIPELINE_DEPTH 4
+
+// Seconds to wait for a response before the connection is considered stalled, and how many times
+// a request is sent before giving up. Poll requests are held open by the server, so they get longer.
+#define LINE_REQUEST_TIMEOUT 30
+#define LINE_POLL_TIMEOUT 300
+#define LINE_REQUEST_ATTEMPTS 3
+
+// Seconds without any data from the poll connection before it's assumed dead and reopened. The
+// initial value is used until the server's long poll interval has been measured, after which the
+// limit follows the interval but never goes below the minimum.
+#define LINE_POLL_IDLE_TIMEOUT 200
+#define LINE_POLL_IDLE_MIN 30
+
+// Length of the window for message delivery latency in seconds, and the default p99 latency in
+// milliseconds above which a warning is logged
+#define LINE_DELIVERY_WINDOW 300
+#define LINE_DELIVERY_WARNING_DEFAULT 10000
+
+// TCP keepalive: seconds before the first probe, between probes and the number of probes
+#define LINE_KEEPALIVE_IDLE 60
+#define LINE_KEEPALIVE_INTERVAL 10
+#define LINE_KEEPALIVE_COUNT 3
+
+// Retry delays in milliseconds after the first failure, which is retried right away, and the number
+// of failures in a row after which only the longest delay is used
+#define LINE_RETRY_MIN_DELAY 2000
+#define LINE_RETRY_MAX_DELAY 120000
+#define LINE_RETRY_CIRCUIT_FAILURES 6
+
+// Most a compressed response body may inflate to, in bytes
+#define LINE_MAX_INFLATED_SIZE (64 * 1024 * 1024)
+
+// Size of the blocks a response arena allocates from, and the most it keeps between responses
+#define LINE_ARENA_BLOCK_SIZE 16384
+#define LINE_ARENA_MAX_RETAINED (1024 * 1024)
+
+// Milliseconds to collect getContact and getGroup lookups for before sending them as one call, and
+// the most ids in one call
+#define LINE_LOOKUP_WINDOW 10
+#define LINE_LOOKUP_BATCH_MAX 100
+
+// Seconds a contact, group or room that's been fetched is served from memory instead of fetched
+// again. Operations about it make it stale before that.
+#define LINE_ENTITY_TTL 600
+
+// Membership changes applied to a group from operations before it's fetched again in full, in case
+// something was missed
+#define LINE_GROUP_DELTA_REFRESH 50
+
+// Most operations to look through at login for what changed since the saved snapshot, before giving
+// up and fetching everything. A snapshot this many revisions behind isn't looked through at all.
+#define LINE_SNAPSHOT_CATCHUP_MAX 1000
+
+// Seconds after which a saved snapshot is no longer trusted and everything is fetched again
+#define LINE_SNAPSHOT_MAX_AGE (7 * 24 * 60 * 60)
+
+// Seconds from a change to the contacts or groups to saving the snapshot, so that a burst of
+// changes is saved once
+#define LINE_SNAPSHOT_SAVE_DELAY 30
+
+// Environment variable with the path of a UNIX socket to serve metrics on. Not served if unset.
+#define LINE_METRICS_SOCKET_ENV "PURPLE_LINE_METRICS_SOCKET"
+
 #define LINE_USER_AGENT "purple-line (LINE for libpurple/Pidgin)"
 #define LINE_APPLICATION "DESKTOPWIN\t5.6.0.1625\tWINDOWS\t5.2.2-XP-x64"
 
 // If you change these account setting constants, it'll break hacks in bitlbee.
 #define LINE_ACCOUNT_CERTIFICATE "line-certificate"
 #define LINE_ACCOUNT_AUTH_TOKEN "line-auth-token"
+#define LINE_ACCOUNT_TRACE_FILE "line-trace-file"
+#define LINE_ACCOUNT_DELIVERY_WARNING "line-delivery-warning"
+#define LINE_ACCOUNT_DECODE_THREAD "line-decode-thread"
+#define LINE_ACCOUNT_COMPRESSION "line-compression"
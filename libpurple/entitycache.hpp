@@ -0,0 +1,169 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "callback.hpp"
+#include "constants.hpp"
+#include "linehttptransport.hpp"
+
+struct EntityCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+
+    // Misses that joined a fetch that was already on its way instead of making a new one
+    uint64_t shared;
+};
+
+// Read-through cache for contacts, groups and rooms by id. Entities are served from the map they're
+// kept in while fresh, that is while they've been stored within LINE_ENTITY_TTL seconds and not
+// invalidated since. Otherwise they're fetched, and lookups of an id that's already being fetched
+// wait for the same fetch.
+//
+// The cache doesn't store fetched entities itself. Whoever updates the map should call stored().
+// Callbacks get a copy they may move out of, or an empty object if the entity couldn't be fetched.
+template <typename T>
+class EntityCache {
+
+public:
+
+    using EntityCallback = Callback<void(T &)>;
+    using FetchFunc = std::function<void(const std::string &, RequestPriority, EntityCallback)>;
+
+private:
+
+    using Waiting = std::vector<EntityCallback>;
+
+    std::map<std::string, T> &entities;
+    FetchFunc fetch;
+
+    // Monotonic time until which each entity is fresh
+    std::map<std::string, gint64> fresh_until;
+
+    // Bumped whenever an entity is invalidated, so that a fetch that started before can tell
+    std::map<std::string, uint64_t> generations;
+
+    std::map<std::string, std::shared_ptr<Waiting>> in_flight;
+
+    EntityCacheStats stats_;
+
+    // Named instead of a lambda so that the waiting list is shared and not copied
+    struct Fetched {
+        EntityCache *cache;
+        std::string id;
+        uint64_t generation;
+        RequestPriority priority;
+        std::shared_ptr<Waiting> waiting;
+
+        void operator()(T &entity) {
+            auto i = cache->in_flight.find(id);
+            if (i != cache->in_flight.end() && i->second == waiting)
+                cache->in_flight.erase(i);
+
+            // Invalidated while on its way, so it may be from before the change. Whoever is
+            // waiting gets it fetched again instead, and nobody stores it as fresh.
+            if (cache->generation(id) != generation) {
+                cache->start_fetch(id, priority, waiting);
+                return;
+            }
+
+            // The last one gets the original, so that everyone can move out of theirs
+            for (size_t j = 0; j + 1 < waiting->size(); j++) {
+                T copy(entity);
+                (*waiting)[j](copy);
+            }
+
+            waiting->back()(entity);
+        }
+    };
+
+    uint64_t generation(const std::string &id) const {
+        auto i = generations.find(id);
+
+        return (i != generations.end()) ? i->second : 0;
+    }
+
+    // Joins a fetch of the id that's already on its way, if there is one
+    void start_fetch(const std::string &id, RequestPriority priority,
+        std::shared_ptr<Waiting> waiting)
+    {
+        auto flight = in_flight.find(id);
+        if (flight != in_flight.end()) {
+            for (EntityCallback &callback : *waiting)
+                flight->second->push_back(std::move(callback));
+
+            return;
+        }
+
+        in_flight[id] = waiting;
+
+        fetch(id, priority, Fetched { this, id, generation(id), priority, waiting });
+    }
+
+public:
+
+    EntityCache(std::map<std::string, T> &entities, FetchFunc fetch)
+        : entities(entities), fetch(fetch), stats_()
+    {
+    }
+
+    void get(const std::string &id, EntityCallback callback,
+        RequestPriority priority=RequestPriority::BACKGROUND)
+    {
+        if (is_fresh(id)) {
+            stats_.hits++;
+
+            T copy(entities[id]);
+            callback(copy);
+            return;
+        }
+
+        stats_.misses++;
+
+        auto flight = in_flight.find(id);
+        if (flight != in_flight.end()) {
+            stats_.shared++;
+
+            flight->second->push_back(std::move(callback));
+            return;
+        }
+
+        auto waiting = std::make_shared<Waiting>();
+        waiting->push_back(std::move(callback));
+
+        start_fetch(id, priority, waiting);
+    }
+
+    bool is_fresh(const std::string &id) const {
+        auto i = fresh_until.find(id);
+
+        return i != fresh_until.end()
+            && i->second > g_get_monotonic_time()
+            && entities.count(id);
+    }
+
+    void stored(const std::string &id) {
+        fresh_until[id] = g_get_monotonic_time() + (gint64)LINE_ENTITY_TTL * G_USEC_PER_SEC;
+    }
+
+    // Lookups after this fetch the entity again. A fetch that's already on its way may have
+    // started before the change, so later lookups don't wait for it, and its result is thrown
+    // away and fetched again for whoever was waiting.
+    void invalidate(const std::string &id) {
+        fresh_until.erase(id);
+        in_flight.erase(id);
+        generations[id]++;
+    }
+
+
+    // Whether any fetches are still on their way
+    bool busy() const { return !in_flight.empty(); }
+
+    const EntityCacheStats &stats() const { return stats_; }
+
+};
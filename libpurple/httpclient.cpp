@@ -1,4 +1,5 @@
-#include <sstream>
+#include <algorithm>
+#include <stdlib.h>
 #include <string.h>
 
 #include <debug.h>
@@ -6,84 +7,171 @@
 #include "constants.hpp"
 #include "httpclient.hpp"
 
+void HTTPClient::RequestList::push_back(HTTPClient::Request *req) {
+    req->prev = tail;
+    req->next = nullptr;
+
+    if (tail)
+        tail->next = req;
+    else
+        head = req;
+
+    tail = req;
+    size++;
+}
+
+HTTPClient::Request *HTTPClient::RequestList::pop_front() {
+    Request *req = head;
+
+    if (req)
+        remove(req);
+
+    return req;
+}
+
+void HTTPClient::RequestList::remove(HTTPClient::Request *req) {
+    if (req->prev)
+        req->prev->next = req->next;
+    else
+        head = req->next;
+
+    if (req->next)
+        req->next->prev = req->prev;
+    else
+        tail = req->prev;
+
+    req->prev = req->next = nullptr;
+    size--;
+}
+
 HTTPClient::HTTPClient(PurpleAccount *acct) :
-    acct(acct),
-    in_flight(0)
+    acct(acct)
 {
 }
 
 HTTPClient::~HTTPClient() {
-    for (Request *r: request_queue) {
-        if (r->handle)
-            purple_util_fetch_url_cancel(r->handle);
+    while (Request *req = fetching.pop_front()) {
+        purple_util_fetch_url_cancel(req->handle);
+        delete req;
+    }
+
+    while (Request *req = waiting.pop_front())
+        delete req;
+
+    while (Request *req = spare.pop_front())
+        delete req;
+}
+
+HTTPClient::Request *HTTPClient::alloc_request() {
+    Request *req = spare.pop_front();
+
+    return req ? req : new Request();
+}
+
+void HTTPClient::free_request(HTTPClient::Request *req) {
+    if (spare.size >= MAX_SPARE) {
+        delete req;
+        return;
     }
+
+    // Keep the string buffers, but drop anything the callback captured right away
+    req->url.clear();
+    req->content_type.clear();
+    req->body.clear();
+    req->callback.reset();
+    req->handle = nullptr;
+
+    spare.push_back(req);
 }
 
 void HTTPClient::request(std::string url, HTTPClient::CompleteFunc callback) {
-    request(url, HTTPFlag::NONE, callback);
+    request(std::move(url), HTTPFlag::NONE, std::move(callback));
 }
 
 void HTTPClient::request(std::string url, HTTPFlag flags, HTTPClient::CompleteFunc callback) {
-    request(url, flags, "", "", callback);
+    request(std::move(url), flags, "", "", std::move(callback));
 }
 
 void HTTPClient::request(std::string url, HTTPFlag flags,
     std::string content_type, std::string body,
     HTTPClient::CompleteFunc callback)
 {
-    Request *req = new Request();
+    Request *req = alloc_request();
     req->client = this;
-    req->url = url;
-    req->content_type = content_type;
-    req->body = body;
+    req->url.swap(url);
+    req->content_type.swap(content_type);
+    req->body.swap(body);
     req->flags = flags;
-    req->callback = callback;
+    req->callback = std::move(callback);
     req->handle = nullptr;
+    req->queued_at = g_get_monotonic_time();
+    req->sent_at = 0;
+
+    waiting.push_back(req);
 
-    request_queue.push_back(req);
+    stats_.requests++;
+    stats_.queue_high_water = std::max(stats_.queue_high_water, waiting.size + fetching.size);
 
     execute_next();
 }
 
 void HTTPClient::execute_next() {
-    while (in_flight < MAX_IN_FLIGHT && request_queue.size() > 0) {
-        Request *req = request_queue.front();
-        request_queue.pop_front();
-
-        std::stringstream ss;
+    while (fetching.size < MAX_IN_FLIGHT && waiting.size > 0) {
+        Request *req = waiting.pop_front();
 
         char *host, *path;
         int port;
 
         purple_url_parse(req->url.c_str(), &host, &port, &path, nullptr, nullptr);
 
-        ss
-            << (req->body.size() ? "POST" : "GET") << " /" << path << " HTTP/1.1" "\r\n"
-            << "Connection: close\r\n"
-            << "Host: " << host << ":" << port << "\r\n"
-            << "User-Agent: " << LINE_USER_AGENT << "\r\n";
+        std::string &data = request_data;
+        data.clear();
+
+        data += req->body.size() ? "POST" : "GET";
+        data += " /";
+        data += path;
+        data += " HTTP/1.1" "\r\n"
+            "Connection: close\r\n"
+            "Host: ";
+        data += host;
+        data += ":";
+        data += std::to_string(port);
+        data += "\r\n"
+            "User-Agent: " LINE_USER_AGENT "\r\n";
 
         free(host);
         free(path);
 
         if (req->flags & HTTPFlag::AUTH) {
-            ss
-                << "X-Line-Application: " << LINE_APPLICATION << "\r\n"
-                << "X-Line-Access: "
-                    << purple_account_get_string(acct, LINE_ACCOUNT_AUTH_TOKEN, "") << "\r\n";
+            data += "X-Line-Application: " LINE_APPLICATION "\r\n"
+                "X-Line-Access: ";
+            data += purple_account_get_string(acct, LINE_ACCOUNT_AUTH_TOKEN, "");
+            data += "\r\n";
+        }
+
+        if (req->content_type.size()) {
+            data += "Content-Type: ";
+            data += req->content_type;
+            data += "\r\n";
+        }
+
+        if (req->body.size()) {
+            data += "Content-Length: ";
+            data += std::to_string(req->body.size());
+            data += "\r\n";
         }
 
-        if (req->content_type.size())
-            ss << "Content-Type: " << req->content_type << "\r\n";
+        data += "\r\n";
+        data += req->body;
 
-        if (req->body.size())
-            ss << "Content-Length: " << req->body.size() << "\r\n";
+        fetching.push_back(req);
 
-        ss
-            << "\r\n"
-            << req->body;
+        // Every request is a new connection
 
-        in_flight++;
+        req->sent_at = g_get_monotonic_time();
+        stats_.queue_time.add(req->sent_at - req->queued_at);
+        stats_.bytes_out += data.size();
+        stats_.connects++;
 
         req->handle = purple_util_fetch_url_request_len_with_account(
             acct,
@@ -91,7 +179,7 @@ void HTTPClient::execute_next() {
             TRUE,
             LINE_USER_AGENT,
             TRUE,
-            ss.str().c_str(),
+            data.c_str(),
             TRUE,
             (req->flags & HTTPFlag::LARGE) ? (100 * 1024 * 1024) : -1,
             purple_cb,
@@ -102,6 +190,12 @@ void HTTPClient::execute_next() {
 void HTTPClient::complete(HTTPClient::Request *req,
     const gchar *url_text, gsize len, const gchar *error_message)
 {
+    fetching.remove(req);
+
+    stats_.responses++;
+    stats_.bytes_in += len;
+    stats_.wire_time.add(g_get_monotonic_time() - req->sent_at);
+
     if (!url_text || error_message) {
         purple_debug_error("util", "HTTP error: %s\n", error_message);
         req->callback(-1, nullptr, 0);
@@ -117,10 +211,10 @@ void HTTPClient::complete(HTTPClient::Request *req,
             *header_end = strstr(url_text, "\r\n\r\n");
 
         if (status_end && header_end) {
-            std::stringstream ss(std::string(url_text, status_end - url_text));
-            ss.ignore(255, ' ');
+            const char *status_start = (const char *)memchr(url_text, ' ', status_end - url_text);
 
-            ss >> status;
+            if (status_start)
+                status = atoi(status_start + 1);
 
             body = (const guchar *)(header_end + 4);
             body_len = len - (header_end - url_text + 4);
@@ -129,10 +223,7 @@ void HTTPClient::complete(HTTPClient::Request *req,
         req->callback(status, body, body_len);
     }
 
-    request_queue.remove(req);
-    delete req;
-
-    in_flight--;
+    free_request(req);
 
     execute_next();
 }
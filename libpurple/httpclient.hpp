@@ -1,12 +1,13 @@
 #pragma once
 
 #include <string>
-#include <functional>
-#include <list>
 
 #include <account.h>
 #include <util.h>
 
+#include "callback.hpp"
+#include "metrics.hpp"
+
 enum class HTTPFlag {
     NONE =  0,
     AUTH =  1 << 0,
@@ -22,11 +23,15 @@ inline constexpr bool operator&(HTTPFlag a, HTTPFlag b) {
 }
 
 class HTTPClient {
-    const int MAX_IN_FLIGHT = 4;
+    const size_t MAX_IN_FLIGHT = 4;
+
+    // Finished requests kept around for reuse, on top of the ones in flight
+    const size_t MAX_SPARE = 8;
 
-    using CompleteFunc = std::function<void(int, const guchar *, gsize)>;
+    using CompleteFunc = Callback<void(int, const guchar *, gsize)>;
 
     struct Request {
+        Request *prev, *next;
         HTTPClient *client;
         std::string url;
         std::string content_type;
@@ -34,12 +39,35 @@ class HTTPClient {
         HTTPFlag flags;
         CompleteFunc callback;
         PurpleUtilFetchUrlData *handle;
+        gint64 queued_at;
+        gint64 sent_at;
+    };
+
+    // Intrusive list so that requests can be queued and removed without allocating
+    struct RequestList {
+        Request *head, *tail;
+        size_t size;
+
+        RequestList() : head(nullptr), tail(nullptr), size(0) { }
+
+        void push_back(Request *req);
+        Request *pop_front();
+        void remove(Request *req);
     };
 
     PurpleAccount *acct;
 
-    std::list<Request *> request_queue;
-    int in_flight;
+    RequestList waiting;
+    RequestList fetching;
+    RequestList spare;
+
+    // Reused for building request heads
+    std::string request_data;
+
+    TransportStats stats_;
+
+    Request *alloc_request();
+    void free_request(Request *req);
 
     void execute_next();
     void complete(Request *req, const gchar *url_text, gsize len, const gchar *error_message);
@@ -58,4 +86,6 @@ public:
         std::string content_type, std::string body,
         CompleteFunc callback);
 
+    const TransportStats &stats() const { return stats_; }
+
 };
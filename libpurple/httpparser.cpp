@@ -0,0 +1,348 @@
+#include <algorithm>
+
+#include <string.h>
+
+#include "httpparser.hpp"
+
+static char ascii_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+// Compares against a lower case string without allocating
+static bool equals_lower(const char *s, size_t len, const char *lower) {
+    size_t i;
+
+    for (i = 0; i < len && lower[i]; i++) {
+        if (ascii_lower(s[i]) != lower[i])
+            return false;
+    }
+
+    return i == len && lower[i] == '\0';
+}
+
+static bool contains_lower(const char *s, size_t len, const char *lower) {
+    size_t lower_len = strlen(lower);
+
+    for (size_t i = 0; i + lower_len <= len; i++) {
+        if (equals_lower(s + i, lower_len, lower))
+            return true;
+    }
+
+    return false;
+}
+
+HttpParser::HttpParser() {
+    reset(false);
+}
+
+void HttpParser::reset(bool keep_alive) {
+    state = State::STATUS_LINE;
+    pos = 0;
+    scan = 0;
+    status_code_ = -1;
+    content_length_ = -1;
+    keep_alive_ = keep_alive;
+    chunked = false;
+    content_encoding_ = Encoding::IDENTITY;
+    has_x_ls_ = false;
+    body_start_ = 0;
+    body_length_ = 0;
+    chunk_remaining = 0;
+}
+
+bool HttpParser::headers_done() const {
+    return state != State::STATUS_LINE && state != State::HEADERS && state != State::ERROR;
+}
+
+size_t HttpParser::body_received(size_t len) const {
+    switch (state) {
+        case State::BODY:
+            return std::min(len - body_start_, (size_t)content_length_);
+
+        case State::BODY_UNTIL_CLOSE:
+        case State::CHUNK_SIZE:
+        case State::CHUNK_DATA:
+        case State::CHUNK_DATA_END:
+        case State::TRAILERS:
+        case State::DONE:
+            return body_length_;
+
+        default:
+            return 0;
+    }
+}
+
+// Finds the end of the line starting at pos. Only bytes that haven't been searched before are
+// looked at.
+bool HttpParser::next_line(uint8_t *data, size_t len, size_t &line_end, size_t &next) {
+    if (scan < pos)
+        scan = pos;
+
+    if (scan >= len)
+        return false;
+
+    uint8_t *nl = (uint8_t *)memchr(data + scan, '\n', len - scan);
+    if (!nl) {
+        scan = len;
+        return false;
+    }
+
+    next = nl - data + 1;
+    line_end = next - 1;
+
+    if (line_end > pos && data[line_end - 1] == '\r')
+        line_end--;
+
+    return true;
+}
+
+HttpParser::Result HttpParser::parse(uint8_t *data, size_t len) {
+    while (true) {
+        size_t line_end, next;
+
+        switch (state) {
+            case State::STATUS_LINE:
+            case State::HEADERS:
+                if (!next_line(data, len, line_end, next))
+                    return Result::NEED_MORE;
+
+                if (state == State::STATUS_LINE) {
+                    if (!parse_status_line((const char *)data + pos, line_end - pos)) {
+                        state = State::ERROR;
+                        return Result::ERROR;
+                    }
+
+                    state = State::HEADERS;
+                } else if (line_end == pos) {
+                    pos = next;
+                    body_start_ = pos;
+                    headers_complete();
+                    continue;
+                } else if (!parse_header((const char *)data + pos, line_end - pos)) {
+                    state = State::ERROR;
+                    return Result::ERROR;
+                }
+
+                pos = next;
+                break;
+
+            case State::BODY:
+                if (len - body_start_ < (size_t)content_length_)
+                    return Result::NEED_MORE;
+
+                body_length_ = (size_t)content_length_;
+                pos = body_start_ + body_length_;
+                state = State::DONE;
+                break;
+
+            case State::BODY_UNTIL_CLOSE:
+                body_length_ = len - body_start_;
+                pos = len;
+                return Result::NEED_MORE;
+
+            case State::CHUNK_SIZE:
+                {
+                    if (!next_line(data, len, line_end, next))
+                        return Result::NEED_MORE;
+
+                    size_t size = 0, i;
+
+                    for (i = pos; i < line_end; i++) {
+                        char c = ascii_lower((char)data[i]);
+                        int digit;
+
+                        if (c >= '0' && c <= '9')
+                            digit = c - '0';
+                        else if (c >= 'a' && c <= 'f')
+                            digit = c - 'a' + 10;
+                        else
+                            break;
+
+                        if (size > (SIZE_MAX >> 4)) {
+                            state = State::ERROR;
+                            return Result::ERROR;
+                        }
+
+                        size = (size << 4) | digit;
+                    }
+
+                    if (i == pos) {
+                        state = State::ERROR;
+                        return Result::ERROR;
+                    }
+
+                    pos = next;
+                    chunk_remaining = size;
+                    state = (size == 0) ? State::TRAILERS : State::CHUNK_DATA;
+                }
+                break;
+
+            case State::CHUNK_DATA:
+                {
+                    if (pos >= len)
+                        return Result::NEED_MORE;
+
+                    size_t take = len - pos;
+                    if (take > chunk_remaining)
+                        take = chunk_remaining;
+
+                    // Move the chunk down over the chunk headers that came before it
+                    size_t body_end = body_start_ + body_length_;
+                    if (body_end != pos)
+                        memmove(data + body_end, data + pos, take);
+
+                    body_length_ += take;
+                    pos += take;
+                    chunk_remaining -= take;
+
+                    if (chunk_remaining == 0)
+                        state = State::CHUNK_DATA_END;
+                }
+                break;
+
+            case State::CHUNK_DATA_END:
+                if (!next_line(data, len, line_end, next))
+                    return Result::NEED_MORE;
+
+                if (line_end != pos) {
+                    state = State::ERROR;
+                    return Result::ERROR;
+                }
+
+                pos = next;
+                state = State::CHUNK_SIZE;
+                break;
+
+            case State::TRAILERS:
+                if (!next_line(data, len, line_end, next))
+                    return Result::NEED_MORE;
+
+                // Trailers are ignored. An empty line ends the response.
+                if (line_end == pos)
+                    state = State::DONE;
+
+                pos = next;
+                break;
+
+            case State::DONE:
+                return Result::DONE;
+
+            case State::ERROR:
+                return Result::ERROR;
+        }
+    }
+}
+
+HttpParser::Result HttpParser::eof() {
+    if (state == State::BODY_UNTIL_CLOSE) {
+        state = State::DONE;
+        return Result::DONE;
+    }
+
+    return (state == State::DONE) ? Result::DONE : Result::ERROR;
+}
+
+bool HttpParser::parse_status_line(const char *line, size_t len) {
+    // HTTP/1.1 200 OK
+
+    if (len < 12 || !equals_lower(line, 5, "http/"))
+        return false;
+
+    const char *sp = (const char *)memchr(line, ' ', len);
+    if (!sp || (size_t)(sp - line) + 4 > len)
+        return false;
+
+    int code = 0;
+    for (int i = 1; i <= 3; i++) {
+        if (sp[i] < '0' || sp[i] > '9')
+            return false;
+
+        code = code * 10 + (sp[i] - '0');
+    }
+
+    status_code_ = code;
+
+    return true;
+}
+
+bool HttpParser::parse_header(const char *line, size_t len) {
+    const char *colon = (const char *)memchr(line, ':', len);
+    if (!colon)
+        return true;
+
+    size_t name_len = colon - line;
+
+    const char *value = colon + 1, *value_end = line + len;
+
+    while (value < value_end && (*value == ' ' || *value == '\t'))
+        value++;
+
+    while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+        value_end--;
+
+    size_t value_len = value_end - value;
+
+    if (equals_lower(line, name_len, "content-length")) {
+        // A length that can't be trusted can't be used to find where the body ends
+        if (value_len == 0)
+            return false;
+
+        int64_t length = 0;
+
+        for (size_t i = 0; i < value_len; i++) {
+            if (value[i] < '0' || value[i] > '9')
+                return false;
+
+            int digit = value[i] - '0';
+
+            if (length > (INT64_MAX - digit) / 10)
+                return false;
+
+            length = length * 10 + digit;
+        }
+
+        content_length_ = length;
+    } else if (equals_lower(line, name_len, "transfer-encoding")) {
+        chunked = contains_lower(value, value_len, "chunked");
+    } else if (equals_lower(line, name_len, "content-encoding")) {
+        if (equals_lower(value, value_len, "gzip") || equals_lower(value, value_len, "x-gzip"))
+            content_encoding_ = Encoding::GZIP;
+        else if (equals_lower(value, value_len, "deflate"))
+            content_encoding_ = Encoding::DEFLATE;
+        else if (!equals_lower(value, value_len, "identity"))
+            content_encoding_ = Encoding::UNKNOWN;
+    } else if (equals_lower(line, name_len, "connection")) {
+        if (equals_lower(value, value_len, "keep-alive"))
+            keep_alive_ = true;
+        else if (equals_lower(value, value_len, "close"))
+            keep_alive_ = false;
+    } else if (equals_lower(line, name_len, "x-ls")) {
+        x_ls_.assign(value, value_len);
+        has_x_ls_ = true;
+    }
+
+    return true;
+}
+
+void HttpParser::headers_complete() {
+    body_length_ = 0;
+
+    if (status_code_ >= 100 && status_code_ < 200) {
+        // Interim response, the real one follows
+        status_code_ = -1;
+        content_length_ = -1;
+        chunked = false;
+        state = State::STATUS_LINE;
+    } else if (chunked) {
+        state = State::CHUNK_SIZE;
+    } else if (status_code_ == 204 || status_code_ == 304) {
+        content_length_ = 0;
+        state = State::BODY;
+    } else if (content_length_ >= 0) {
+        state = State::BODY;
+    } else {
+        // No length at all, the body ends when the connection does
+        keep_alive_ = false;
+        state = State::BODY_UNTIL_CLOSE;
+    }
+}
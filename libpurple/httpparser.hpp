@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Resumable HTTP/1.1 response parser. It is fed the whole receive buffer every time more data
+// arrives but only looks at the bytes it hasn't seen yet. Chunked bodies are decoded in place, so
+// when a response is done its body is contiguous at body_start() in the same buffer.
+class HttpParser {
+
+    enum class State {
+        STATUS_LINE,
+        HEADERS,
+        BODY,
+        BODY_UNTIL_CLOSE,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_DATA_END,
+        TRAILERS,
+        DONE,
+        ERROR,
+    };
+
+public:
+
+    enum class Result {
+        NEED_MORE,
+        DONE,
+        ERROR,
+    };
+
+    enum class Encoding {
+        IDENTITY,
+        GZIP,
+        DEFLATE,
+        UNKNOWN,
+    };
+
+private:
+
+    State state;
+
+    // Start of the next unparsed line or body byte, and how far a line end has been searched for
+    size_t pos;
+    size_t scan;
+
+    int status_code_;
+    int64_t content_length_;
+    bool keep_alive_;
+    bool chunked;
+    Encoding content_encoding_;
+    bool has_x_ls_;
+    std::string x_ls_;
+
+    size_t body_start_;
+    size_t body_length_;
+    size_t chunk_remaining;
+
+public:
+
+    HttpParser();
+
+    // Starts a new response. keep_alive is the default if the server doesn't say either way.
+    void reset(bool keep_alive);
+
+    // data points to the start of the response and len is the number of bytes received so far.
+    // Bytes after body_start() may be moved around while decoding a chunked body.
+    Result parse(uint8_t *data, size_t len);
+
+    // The connection was closed. Completes a response that is delimited by closing.
+    Result eof();
+
+    bool headers_done() const;
+
+    int status_code() const { return status_code_; }
+    bool keep_alive() const { return keep_alive_; }
+    Encoding content_encoding() const { return content_encoding_; }
+    bool has_x_ls() const { return has_x_ls_; }
+    const std::string &x_ls() const { return x_ls_; }
+
+    // Valid when done: the decoded body, and the number of bytes the whole response took up in the
+    // buffer.
+    size_t body_start() const { return body_start_; }
+    size_t body_length() const { return body_length_; }
+    size_t message_length() const { return pos; }
+
+    // Number of body bytes that are already decoded at body_start(), before the response is done.
+    // len is the number of bytes received, as passed to parse().
+    size_t body_received(size_t len) const;
+
+private:
+
+    bool next_line(uint8_t *data, size_t len, size_t &line_end, size_t &next);
+    bool parse_status_line(const char *line, size_t len);
+    // Returns false if a header the message can't be read without is invalid
+    bool parse_header(const char *line, size_t len);
+    void headers_complete();
+
+};
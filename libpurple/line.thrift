@@ -318,6 +318,15 @@ struct RSAKey {
     4: string sessionKey;
 }
 
+// Not part of the protocol. Saved by the plugin between sessions, see snapshot.hpp.
+struct Snapshot {
+    1: i64 revision;
+    2: Profile profile;
+    3: list<Contact> contacts;
+    4: list<Group> groups;
+    5: i64 savedTime;
+}
+
 exception TalkException {
     1: ErrorCode code;
     2: string reason;
@@ -0,0 +1,205 @@
+#include "linehttppool.hpp"
+
+LineHttpPool::LineHttpPool(
+        PurpleAccount *acct,
+        PurpleConnection *conn,
+        std::string host,
+        uint16_t port,
+        bool ls_mode,
+        size_t lane_count) :
+    current(nullptr)
+{
+    if (lane_count == 0)
+        lane_count = 1;
+
+    for (size_t i = 0; i < lane_count; i++) {
+        lanes.push_back(std::make_shared<LineHttpTransport>(acct, conn, host, port, ls_mode));
+        lanes.back()->set_response_hook(lane_responding, (gpointer)this);
+    }
+}
+
+// Reads go to the lane whose response is being handled
+void LineHttpPool::lane_responding(gpointer data, LineHttpTransport *lane,
+    const RequestHandle &handle)
+{
+    LineHttpPool *pool = (LineHttpPool *)data;
+
+    pool->current = lane;
+
+    // The request being answered may have been the last one for its key
+    pool->ordered.answered(handle);
+}
+
+void LineHttpPool::set_auto_reconnect(bool auto_reconnect) {
+    for (auto &lane: lanes)
+        lane->set_auto_reconnect(auto_reconnect);
+}
+
+void LineHttpPool::set_pipeline_depth(size_t depth) {
+    for (auto &lane: lanes)
+        lane->set_pipeline_depth(depth);
+}
+
+void LineHttpPool::set_timeout(int seconds) {
+    for (auto &lane: lanes)
+        lane->set_timeout(seconds);
+}
+
+void LineHttpPool::set_idle_timeout(int seconds) {
+    for (auto &lane: lanes)
+        lane->set_idle_timeout(seconds);
+}
+
+void LineHttpPool::set_supervisor(std::shared_ptr<RetrySupervisor> supervisor) {
+    for (auto &lane: lanes)
+        lane->set_supervisor(supervisor);
+}
+
+void LineHttpPool::set_compression(bool compression) {
+    for (auto &lane: lanes)
+        lane->set_compression(compression);
+}
+
+void LineHttpPool::open() {
+    // Lanes connect on demand when they get their first request.
+}
+
+void LineHttpPool::close() {
+    for (auto &lane: lanes)
+        lane->close();
+
+    request_body = "";
+    ordered.clear();
+}
+
+uint32_t LineHttpPool::read_virt(uint8_t *buf, uint32_t len) {
+    if (!current)
+        return 0;
+
+    return current->read_virt(buf, len);
+}
+
+const uint8_t *LineHttpPool::borrow_virt(uint8_t *buf, uint32_t *len) {
+    if (!current)
+        return nullptr;
+
+    return current->borrow_virt(buf, len);
+}
+
+void LineHttpPool::consume_virt(uint32_t len) {
+    if (current)
+        current->consume_virt(len);
+}
+
+void LineHttpPool::write_virt(const uint8_t *buf, uint32_t len) {
+    request_body.append((const char *)buf, len);
+}
+
+int LineHttpPool::status_code() {
+    return current ? current->status_code() : -1;
+}
+
+int LineHttpPool::content_length() {
+    return current ? current->content_length() : -1;
+}
+
+bool LineHttpPool::failed() const {
+    return current && current->failed();
+}
+
+void LineHttpPool::substitute_body(const std::string &body) {
+    if (current)
+        current->substitute_body(body);
+}
+
+TransportStats LineHttpPool::stats() const {
+    TransportStats total;
+
+    for (auto &lane: lanes)
+        total.merge(lane->stats());
+
+    return total;
+}
+
+size_t LineHttpPool::queue_size() const {
+    size_t total = 0;
+
+    for (auto &lane: lanes)
+        total += lane->queue_size(RequestPriority::BACKGROUND);
+
+    return total;
+}
+
+gint64 LineHttpPool::queue_time() {
+    return current ? current->queue_time() : 0;
+}
+
+gint64 LineHttpPool::wire_time() {
+    return current ? current->wire_time() : 0;
+}
+
+Arena *LineHttpPool::arena() {
+    return current ? &current->arena() : nullptr;
+}
+
+uint64_t LineHttpPool::compressed_bytes() const {
+    uint64_t total = 0;
+
+    for (auto &lane: lanes)
+        total += lane->compressed_bytes();
+
+    return total;
+}
+
+uint64_t LineHttpPool::uncompressed_bytes() const {
+    uint64_t total = 0;
+
+    for (auto &lane: lanes)
+        total += lane->uncompressed_bytes();
+
+    return total;
+}
+
+// Load is counted as the requests a new one of the given priority would wait behind. Ties go to
+// the lowest numbered lane, so extra lanes are only connected once the first one is busy.
+size_t LineHttpPool::least_loaded_lane(RequestPriority priority) {
+    size_t best = 0;
+
+    for (size_t i = 1; i < lanes.size(); i++) {
+        if (lanes[i]->queue_size(priority) < lanes[best]->queue_size(priority))
+            best = i;
+    }
+
+    return best;
+}
+
+RequestHandle LineHttpPool::request(const char *method, const char *path,
+    const char *content_type, ResponseCallback callback)
+{
+    return request(RequestPriority::NORMAL, std::string(), method, path, content_type, false,
+        std::move(callback));
+}
+
+RequestHandle LineHttpPool::request(RequestPriority priority, const std::string &key,
+    const char *method, const char *path, const char *content_type, bool idempotent,
+    ResponseCallback callback)
+{
+    size_t index;
+
+    if (key.empty() || !ordered.find(key, index))
+        index = least_loaded_lane(priority);
+
+    LineHttpTransport *lane = lanes[index].get();
+
+    std::string body;
+    body.swap(request_body);
+    lane->reuse_buffer(request_body);
+
+    RequestHandle handle = lane->request(priority, method, path, content_type,
+        std::string(), std::move(body), idempotent, std::move(callback));
+
+    if (!key.empty())
+        ordered.sent(key, index, handle);
+
+    return handle;
+}
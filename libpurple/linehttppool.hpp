@@ -0,0 +1,90 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <account.h>
+
+#include <thrift/transport/TTransport.h>
+
+#include "linehttptransport.hpp"
+#include "orderedkeys.hpp"
+
+// A set of LineHttpTransport lanes to the same host. Each request is handed to the least loaded
+// lane so that a slow response only holds up the requests that happen to be behind it on its own
+// lane. Looks like a single transport to the Thrift protocol: writes are buffered until request()
+// picks a lane, and reads come from the lane whose response is currently being handled.
+class LineHttpPool : public apache::thrift::transport::TTransport {
+
+    std::vector<std::shared_ptr<LineHttpTransport>> lanes;
+
+    LineHttpTransport *current;
+
+    std::string request_body;
+
+    // Requests with the same ordering key stick to one lane while the last one sent is
+    // outstanding
+    OrderedKeys ordered;
+
+public:
+
+    LineHttpPool(PurpleAccount *acct, PurpleConnection *conn,
+        std::string host, uint16_t port,
+        bool ls_mode, size_t lane_count);
+
+    void set_auto_reconnect(bool auto_reconnect);
+    void set_pipeline_depth(size_t depth);
+    void set_timeout(int seconds);
+    void set_idle_timeout(int seconds);
+    void set_supervisor(std::shared_ptr<RetrySupervisor> supervisor);
+    void set_compression(bool compression);
+
+    virtual void open();
+    virtual void close();
+
+    virtual uint32_t read_virt(uint8_t *buf, uint32_t len);
+    virtual void write_virt(const uint8_t *buf, uint32_t len);
+    virtual const uint8_t *borrow_virt(uint8_t *buf, uint32_t *len);
+    virtual void consume_virt(uint32_t len);
+
+    // method, path and content_type have to be string constants, see LineHttpTransport::request
+    RequestHandle request(const char *method, const char *path, const char *content_type,
+        ResponseCallback callback);
+    RequestHandle request(RequestPriority priority, const std::string &key,
+        const char *method, const char *path, const char *content_type, bool idempotent,
+        ResponseCallback callback);
+    int status_code();
+    int content_length();
+
+    // See LineHttpTransport::failed
+    bool failed() const;
+    void substitute_body(const std::string &body);
+
+    // Combined over all lanes
+    TransportStats stats() const;
+    size_t queue_size() const;
+
+    gint64 queue_time();
+    gint64 wire_time();
+
+    // Body of the next request as written by Thrift so far
+    const std::string &pending_request() const { return request_body; }
+
+    // Arena of the lane whose response is currently being handled
+    Arena *arena();
+
+    uint64_t compressed_bytes() const;
+    uint64_t uncompressed_bytes() const;
+
+private:
+
+    size_t least_loaded_lane(RequestPriority priority);
+
+    static void lane_responding(gpointer data, LineHttpTransport *lane,
+        const RequestHandle &handle);
+
+};
@@ -2,6 +2,13 @@
 #include <sstream>
 #include <limits>
 
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
 #include <debug.h>
 
 #include <thrift/transport/TTransportException.h>
@@ -25,19 +32,43 @@ LineHttpTransport::LineHttpTransport(
     state(ConnectionState::DISCONNECTED),
     auto_reconnect(false),
     reconnect_timeout_handle(0),
-    reconnect_timeout(0),
+    supervisor(std::make_shared<RetrySupervisor>(host)),
     ssl(NULL),
     input_handle(0),
+    write_handle(0),
+    deadline_handle(0),
     connection_id(0),
+    request_timeout(LINE_REQUEST_TIMEOUT),
+    idle_timeout(0),
+    last_activity(0),
+    head_since(0),
+    failing(false),
+    response_hook(nullptr),
+    response_hook_data(nullptr),
+    requests_written(0),
+    request_part(0),
     request_written(0),
-    keep_alive(false),
-    status_code_(0),
-    content_length_(0)
+    pipeline_depth(1),
+    responses_received(0),
+    body_data(&response_data),
+    response_remaining(0),
+    compression(false),
+    inflater_ready(false),
+    inflate_started(false),
+    inflate_ended(false),
+    body_inflated(0),
+    compressed_bytes_(0),
+    uncompressed_bytes_(0),
+    queue_time_(0),
+    wire_time_(0)
 {
 }
 
 LineHttpTransport::~LineHttpTransport() {
     close();
+
+    if (inflater_ready)
+        inflateEnd(&inflater);
 }
 
 void LineHttpTransport::set_auto_reconnect(bool auto_reconnect) {
@@ -45,21 +76,46 @@ void LineHttpTransport::set_auto_reconnect(bool auto_reconnect) {
         this->auto_reconnect = auto_reconnect;
 }
 
+void LineHttpTransport::set_pipeline_depth(size_t depth) {
+    pipeline_depth = depth ? depth : 1;
+}
+
+void LineHttpTransport::set_timeout(int seconds) {
+    request_timeout = seconds;
+}
+
+void LineHttpTransport::set_idle_timeout(int seconds) {
+    idle_timeout = seconds;
+
+    if (!request_queue.empty())
+        arm_deadline();
+}
+
+void LineHttpTransport::set_supervisor(std::shared_ptr<RetrySupervisor> supervisor) {
+    this->supervisor = supervisor;
+}
+
+void LineHttpTransport::set_compression(bool compression) {
+    this->compression = compression;
+    header_block = "";
+}
+
 int LineHttpTransport::status_code() {
-    return status_code_;
+    return failing ? 0 : parser.status_code();
 }
 
 int LineHttpTransport::content_length() {
-    return content_length_;
+    return parser.headers_done() ? (int)parser.body_length() : -1;
 }
 
 void LineHttpTransport::open() {
     if (state != ConnectionState::DISCONNECTED)
         return;
 
-    state = ConnectionState::CONNECTED;
+    state = ConnectionState::CONNECTING;
 
-    in_progress = false;
+    responses_received = 0;
+    reset_response();
 
     connection_id++;
     ssl = purple_ssl_connect(
@@ -71,8 +127,51 @@ void LineHttpTransport::open() {
         (gpointer)this);
 }
 
+// Makes the kernel notice a connection that has silently gone away (e.g. dropped by a NAT) even
+// when no data is being sent. Failing to set these is not an error.
+void LineHttpTransport::set_socket_options() {
+    int fd = ssl->fd;
+    int on = 1;
+
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+
+#ifdef TCP_KEEPIDLE
+    int idle = LINE_KEEPALIVE_IDLE;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+#elif defined(TCP_KEEPALIVE)
+    int idle = LINE_KEEPALIVE_IDLE;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPALIVE, &idle, sizeof(idle));
+#endif
+
+#ifdef TCP_KEEPINTVL
+    int interval = LINE_KEEPALIVE_INTERVAL;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+#endif
+
+#ifdef TCP_KEEPCNT
+    int count = LINE_KEEPALIVE_COUNT;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+#endif
+
+#ifdef TCP_USER_TIMEOUT
+    // Also give up on data that isn't acknowledged within the same time
+    unsigned int user_timeout =
+        (LINE_KEEPALIVE_IDLE + LINE_KEEPALIVE_INTERVAL * LINE_KEEPALIVE_COUNT) * 1000;
+    setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout));
+#endif
+}
+
 void LineHttpTransport::ssl_connect(PurpleSslConnection *, PurpleInputCondition) {
-    reconnect_timeout = 0;
+    state = ConnectionState::CONNECTED;
+
+    stats_.connects++;
+
+    set_socket_options();
+
+    // Stays for the lifetime of the connection so that the server closing an idle connection is
+    // noticed right away
+    input_handle = purple_input_add(ssl->fd, PURPLE_INPUT_READ,
+        WRAPPER(LineHttpTransport::ssl_read), (gpointer)this);
 
     send_next();
 }
@@ -82,6 +181,12 @@ void LineHttpTransport::ssl_error(PurpleSslConnection *, PurpleSslErrorType err)
 
     ssl = nullptr;
 
+    if (auto_reconnect) {
+        close();
+        schedule_reconnect();
+        return;
+    }
+
     purple_connection_ssl_error(conn, err);
 }
 
@@ -101,68 +206,454 @@ void LineHttpTransport::close() {
         input_handle = 0;
     }
 
-    purple_ssl_close(ssl);
-    ssl = NULL;
+    if (write_handle) {
+        purple_input_remove(write_handle);
+        write_handle = 0;
+    }
+
+    if (deadline_handle) {
+        purple_timeout_remove(deadline_handle);
+        deadline_handle = 0;
+    }
+
+    if (ssl) {
+        purple_ssl_close(ssl);
+        ssl = NULL;
+    }
+
     connection_id++;
 
     x_ls = "";
+    header_block = "";
+
+    // Requests that were on the wire go back to the front of their queues and are sent again on
+    // the next connection, unless they were cancelled
+    while (!request_queue.empty()) {
+        Request &req = request_queue.back();
+
+        if (req.handle.cancelled())
+            req.handle.state->done = true;
+        else
+            pending[(int)req.priority].push_front(std::move(req));
+
+        request_queue.pop_back();
+    }
+
+    requests_written = 0;
+    request_part = 0;
+    request_written = 0;
 
-    request_buf.str("");
+    request_body = "";
 
-    response_str = "";
-    response_buf.str("");
+    response_data.clear();
+    decoded_data.clear();
+    body_data = &response_data;
+    response_remaining = 0;
 }
 
 uint32_t LineHttpTransport::read_virt(uint8_t *buf, uint32_t len) {
-    return (uint32_t )response_buf.sgetn((char *)buf, len);
+    if (len > response_remaining)
+        len = (uint32_t)response_remaining;
+
+    memcpy(buf, body_data->data(), len);
+    consume_virt(len);
+
+    return len;
+}
+
+const uint8_t *LineHttpTransport::borrow_virt(uint8_t *, uint32_t *len) {
+    if (*len > response_remaining)
+        return nullptr;
+
+    *len = (uint32_t)std::min(response_remaining, (size_t)std::numeric_limits<uint32_t>::max());
+
+    return body_data->data();
+}
+
+void LineHttpTransport::consume_virt(uint32_t len) {
+    if (len > response_remaining) {
+        throw apache::thrift::transport::TTransportException(
+            apache::thrift::transport::TTransportException::BAD_ARGS,
+            "consume did not follow a borrow.");
+    }
+
+    body_data->consume(len);
+    response_remaining -= len;
 }
 
 void LineHttpTransport::write_virt(const uint8_t *buf, uint32_t len) {
-    request_buf.sputn((const char *)buf, len);
+    request_body.append((const char *)buf, len);
+}
+
+RequestHandle LineHttpTransport::request(const char *method, const char *path,
+    const char *content_type, ResponseCallback callback)
+{
+    std::string body;
+    body.swap(request_body);
+    reuse_buffer(request_body);
+
+    return request(method, path, content_type, std::move(body), std::move(callback));
 }
 
-void LineHttpTransport::request(std::string method, std::string path, std::string content_type,
-    std::function<void()> callback)
+RequestHandle LineHttpTransport::request(const char *method, const char *path,
+    const char *content_type, std::string body, ResponseCallback callback)
 {
-    Request req;
+    return request(RequestPriority::NORMAL, method, path, content_type, std::string(),
+        std::move(body), false, std::move(callback));
+}
+
+RequestHandle LineHttpTransport::request(RequestPriority priority,
+    const char *method, const char *path, const char *content_type,
+    std::string content_params, std::string body, bool idempotent,
+    ResponseCallback callback)
+{
+    RingQueue<Request> &queue = pending[(int)priority];
+
+    queue.push_back(Request());
+
+    Request &req = queue.back();
     req.method = method;
     req.path = path;
     req.content_type = content_type;
-    req.body = request_buf.str();
-    req.callback = callback;
-    request_queue.push(req);
-
-    request_buf.str("");
+    req.content_params = std::move(content_params);
+    req.body = std::move(body);
+    req.callback = std::move(callback);
+    req.priority = priority;
+    req.handle.state = std::allocate_shared<RequestHandle::State>(
+        RecyclingAllocator<RequestHandle::State>(), RequestHandle::State { false, false });
+    req.queued_at = g_get_monotonic_time();
+    req.waited = 0;
+    req.sent_at = 0;
+    req.timeout = request_timeout;
+    req.attempts = 0;
+    req.idempotent = idempotent;
+
+    RequestHandle handle = req.handle;
+
+    stats_.requests++;
+    stats_.queue_high_water = std::max(stats_.queue_high_water,
+        queue_size(RequestPriority::BACKGROUND));
 
     send_next();
+
+    return handle;
+}
+
+void LineHttpTransport::set_response_hook(
+    void (*hook)(gpointer data, LineHttpTransport *transport, const RequestHandle &handle),
+    gpointer data)
+{
+    response_hook = hook;
+    response_hook_data = data;
+}
+
+void LineHttpTransport::reuse_buffer(std::string &buf) {
+    if (buf.capacity() > 0 || spare_buffers.empty())
+        return;
+
+    buf.swap(spare_buffers.back());
+    spare_buffers.pop_back();
+}
+
+void LineHttpTransport::keep_buffer(std::string &buf) {
+    if (buf.capacity() == 0 || spare_buffers.size() >= SPARE_BUFFERS)
+        return;
+
+    buf.clear();
+    spare_buffers.push_back(std::move(buf));
+}
+
+size_t LineHttpTransport::queue_size(RequestPriority priority) const {
+    size_t size = request_queue.size();
+
+    for (int p = 0; p <= (int)priority; p++)
+        size += pending[p].size();
+
+    return size;
+}
+
+// Each priority gets a head start over the next one. The waiting request with the earliest
+// arrival time plus head start goes next, so a higher priority request only overtakes lower
+// priority ones that have been waiting for less than the difference.
+RingQueue<LineHttpTransport::Request> *LineHttpTransport::next_pending() {
+    static const gint64 head_start[PRIORITY_COUNT] = {
+        0,
+        2 * G_USEC_PER_SEC,
+        10 * G_USEC_PER_SEC,
+    };
+
+    RingQueue<Request> *best = nullptr;
+    gint64 best_deadline = 0;
+
+    for (int p = 0; p < PRIORITY_COUNT; p++) {
+        // Cancelled requests are dropped without ever being sent
+        while (!pending[p].empty() && pending[p].front().handle.cancelled()) {
+            pending[p].front().handle.state->done = true;
+            pending[p].pop_front();
+        }
+
+        if (pending[p].empty())
+            continue;
+
+        gint64 deadline = pending[p].front().queued_at + head_start[p];
+
+        if (!best || deadline < best_deadline) {
+            best = &pending[p];
+            best_deadline = deadline;
+        }
+    }
+
+    return best;
 }
 
 void LineHttpTransport::send_next() {
-    if (state != ConnectionState::CONNECTED) {
+    if (!next_pending())
+        return;
+
+    if (state == ConnectionState::DISCONNECTED) {
         open();
         return;
     }
 
-    if (in_progress || request_queue.empty())
+    if (state != ConnectionState::CONNECTED)
+        return;
+
+    // Only keep-alive connections can have more than one request on the wire
+    size_t depth = ls_mode ? pipeline_depth : 1;
+    size_t in_flight_before = request_queue.size();
+
+    // The idle limit counts from when the connection started waiting for something, and the
+    // first request's own limit from when it was sent
+    if (in_flight_before == 0) {
+        last_activity = g_get_monotonic_time();
+        head_since = last_activity;
+    }
+
+    while (request_queue.size() < depth) {
+        RingQueue<Request> *queue = next_pending();
+        if (!queue)
+            break;
+
+        request_queue.push_back(std::move(queue->front()));
+        queue->pop_front();
+
+        Request &req = request_queue.back();
+
+        gint64 now = g_get_monotonic_time();
+
+        // Queue time counts until the first attempt, wire time from the last one
+        if (req.attempts == 0) {
+            req.waited = now - req.queued_at;
+            stats_.queue_time.add(req.waited);
+        }
+
+        req.sent_at = now;
+        req.attempts++;
+
+        write_request(req);
+    }
+
+    if (request_queue.size() == in_flight_before)
         return;
 
-    keep_alive = ls_mode;
-    status_code_ = -1;
-    content_length_ = -1;
+    arm_deadline();
 
-    Request &next_req = request_queue.front();
+    // Try writing right away. A write watcher is only needed if the socket can't take it all.
+    ssl_write(ssl->fd, PURPLE_INPUT_WRITE);
+}
+
+void LineHttpTransport::schedule_reconnect() {
+    guint delay = supervisor->failure();
+
+    stats_.reconnects++;
+
+    purple_debug_info("line", "Reconnecting to %s in %ums...\n", host.c_str(), delay);
+
+    state = ConnectionState::RECONNECTING;
+
+    reconnect_timeout_handle = purple_timeout_add(
+        delay,
+        WRAPPER(LineHttpTransport::reconnect_timeout_cb),
+        (gpointer)this);
+}
+
+int LineHttpTransport::reconnect_timeout_cb() {
+    reconnect_timeout_handle = 0;
+
+    supervisor->retrying();
+
+    state = ConnectionState::DISCONNECTED;
+
+    open();
+
+    return FALSE;
+}
+
+// Only the request whose response is arriving next can be overdue. Those behind it are just
+// waiting their turn, so their time starts when they get to the head.
+gint64 LineHttpTransport::head_deadline() const {
+    const Request &head = request_queue.front();
+
+    return std::max(head_since, last_activity) + (gint64)head.timeout * G_USEC_PER_SEC;
+}
+
+// Runs deadline_cb when the response at the head of the queue is overdue or the connection has
+// been idle for too long. Data arriving in the meantime doesn't re-arm it, deadline_cb checks
+// again and waits longer if needed.
+void LineHttpTransport::arm_deadline() {
+    if (deadline_handle) {
+        purple_timeout_remove(deadline_handle);
+        deadline_handle = 0;
+    }
+
+    if (request_queue.empty())
+        return;
+
+    gint64 deadline = head_deadline();
+
+    if (idle_timeout > 0)
+        deadline = std::min(deadline, last_activity + (gint64)idle_timeout * G_USEC_PER_SEC);
+
+    gint64 delay = (deadline - g_get_monotonic_time()) / 1000 + 1;
+
+    deadline_handle = purple_timeout_add(
+        (guint)std::max(delay, (gint64)1),
+        WRAPPER(LineHttpTransport::deadline_cb),
+        (gpointer)this);
+}
+
+// A response is overdue or nothing has been received for too long. The server or something in
+// between may have stopped answering without closing the connection, so tear it down and send the
+// unanswered requests again on a new one, as far as that's safe.
+int LineHttpTransport::deadline_cb() {
+    deadline_handle = 0;
+
+    if (request_queue.empty())
+        return FALSE;
+
+    gint64 now = g_get_monotonic_time();
+
+    bool idle = idle_timeout > 0
+        && now - last_activity >= (gint64)idle_timeout * G_USEC_PER_SEC;
+
+    if (idle) {
+        // Nothing at all has arrived for too long, the connection is most likely gone
+        purple_debug_warning("line", "Nothing received from %s in %ds, reconnecting.\n",
+            host.c_str(), idle_timeout);
+    } else if (head_deadline() > now) {
+        arm_deadline();
+        return FALSE;
+    } else {
+        purple_debug_warning("line", "Request to %s timed out, %d on the wire.\n",
+            host.c_str(), (int)request_queue.size());
+
+        stats_.timeouts++;
+    }
+
+    if (request_queue.front().attempts >= LINE_REQUEST_ATTEMPTS) {
+        purple_connection_error(conn, "LINE: Server is not responding.");
+        return FALSE;
+    }
+
+    reconnect();
+
+    return FALSE;
+}
+
+// Tears the connection down and sends whatever is safe to send again on a new one
+void LineHttpTransport::reconnect() {
+    RingQueue<Request> unsafe;
+    take_unsafe_requests(unsafe);
+
+    close();
+    send_next();
+
+    fail_requests(unsafe);
+}
+
+// The server may already have acted on a request that was written in full, even if the response
+// never arrived. Those that can't be repeated safely are taken out of request_queue before it's
+// put back to be sent again, so that they can be failed instead.
+void LineHttpTransport::take_unsafe_requests(RingQueue<Request> &unsafe) {
+    size_t count = request_queue.size();
+
+    for (size_t i = 0; i < count; i++) {
+        Request req = std::move(request_queue.front());
+        request_queue.pop_front();
+
+        if (i < requests_written && !req.idempotent && !req.handle.cancelled()) {
+            req.handle.state->done = true;
+            unsafe.push_back(std::move(req));
+        } else {
+            request_queue.push_back(std::move(req));
+        }
+    }
+
+    requests_written -= unsafe.size();
+}
+
+// Runs the callbacks of requests that were given up on, with no response. Called once the
+// connection is closed, so the callbacks are free to make new requests.
+void LineHttpTransport::fail_requests(RingQueue<Request> &failed) {
+    if (!failed.empty()) {
+        purple_debug_warning("line", "Giving up on %d requests to %s that may have been handled.\n",
+            (int)failed.size(), host.c_str());
+    }
+
+    while (!failed.empty()) {
+        Request req = std::move(failed.front());
+        failed.pop_front();
+
+        failing = true;
+
+        decoded_data.clear();
+        body_data = &decoded_data;
+        response_remaining = 0;
+
+        queue_time_ = req.waited;
+        wire_time_ = g_get_monotonic_time() - req.sent_at;
+
+        if (response_hook)
+            response_hook(response_hook_data, this, req.handle);
+
+        bool ok = run_callback(req);
+
+        failing = false;
+
+        decoded_data.clear();
+        body_data = &response_data;
+        response_remaining = 0;
+
+        if (!ok)
+            return;
+
+        arena_.reset();
+    }
+}
+
+void LineHttpTransport::substitute_body(const std::string &body) {
+    decoded_data.clear();
+    memcpy(decoded_data.prepare(body.size()), body.data(), body.size());
+    decoded_data.commit(body.size());
+
+    body_data = &decoded_data;
+    response_remaining = body.size();
+}
+
+const std::string &LineHttpTransport::static_headers() {
+    if (header_block != "" && header_block_x_ls == x_ls)
+        return header_block;
 
     std::ostringstream data;
 
-    data
-        << next_req.method << " " << next_req.path << " HTTP/1.1" "\r\n";
+    if (compression)
+        data << "Accept-Encoding: gzip, deflate\r\n";
 
     if (ls_mode && x_ls != "") {
         data << "X-LS: " << x_ls << "\r\n";
     } else {
         data
             << "Connection: Keep-Alive\r\n"
-            << "Content-Type: " << next_req.content_type << "\r\n"
             << "Host: " << host << ":" << port << "\r\n"
             << "User-Agent: " LINE_USER_AGENT "\r\n"
             << "X-Line-Application: " LINE_APPLICATION "\r\n";
@@ -172,64 +663,98 @@ void LineHttpTransport::send_next() {
             data << "X-Line-Access: " << auth_token << "\r\n";
     }
 
-    if (next_req.method == "POST")
-        data << "Content-Length: " << next_req.body.size() << "\r\n";
+    header_block = data.str();
+    header_block_x_ls = x_ls;
 
-    data
-        << "\r\n"
-        << next_req.body;
+    return header_block;
+}
 
-    request_data = data.str();
-    request_written = 0;
-    in_progress = true;
+// Builds the request line and headers. The body is written from the request as it is.
+void LineHttpTransport::write_request(Request &req) {
+    const std::string &headers = static_headers();
 
-    input_handle = purple_input_add(ssl->fd, PURPLE_INPUT_WRITE,
-        WRAPPER(LineHttpTransport::ssl_write), (gpointer)this);
-    ssl_write(ssl->fd, PURPLE_INPUT_WRITE);
-}
+    std::string &head = req.head;
 
-int LineHttpTransport::reconnect_timeout_cb() {
-    reconnect_timeout = reconnect_timeout ? 10 : 60;
+    reuse_buffer(head);
+    head.clear();
+    head.reserve(strlen(req.method) + strlen(req.path) + headers.size()
+        + req.content_params.size() + 128);
 
-    state = ConnectionState::DISCONNECTED;
+    head += req.method;
+    head += " ";
+    head += req.path;
+    head += " HTTP/1.1\r\n";
+    head += headers;
 
-    open();
+    if (!(ls_mode && x_ls != "")) {
+        head += "Content-Type: ";
+        head += req.content_type;
 
-    return FALSE;
-}
+        if (!req.content_params.empty()) {
+            head += "; ";
+            head += req.content_params;
+        }
 
-void LineHttpTransport::write_request() {
-    if (request_written < request_data.size()) {
-        size_t r = purple_ssl_write(ssl,
-            request_data.c_str() + request_written, request_data.size() - request_written);
+        head += "\r\n";
+    }
 
-        request_written += r;
+    if (strcmp(req.method, "POST") == 0) {
+        // Formatted in place instead of with std::to_string, which makes a string
+        char length[24];
+        snprintf(length, sizeof(length), "%zu", req.body.size());
 
-        purple_debug_info("line", "Wrote: %d, %d out of %d!\n",
-            (int)r, (int)request_written, (int)request_data.size());
+        head += "Content-Length: ";
+        head += length;
+        head += "\r\n";
     }
+
+    head += "\r\n";
 }
 
 void LineHttpTransport::ssl_write(gint, PurpleInputCondition) {
     if (state != ConnectionState::CONNECTED) {
-        if (input_handle) {
-            purple_input_remove(input_handle);
-            input_handle = 0;
+        if (write_handle) {
+            purple_input_remove(write_handle);
+            write_handle = 0;
         }
 
         return;
     }
 
-    if (request_written < request_data.size()) {
-        request_written += purple_ssl_write(ssl,
-            request_data.c_str() + request_written, request_data.size() - request_written);
-    }
+    while (requests_written < request_queue.size()) {
+        Request &req = request_queue[requests_written];
+        const std::string &part = (request_part == 0) ? req.head : req.body;
 
-    if (request_written >= request_data.size()) {
-        purple_input_remove(input_handle);
+        if (request_written < part.size()) {
+            size_t r = purple_ssl_write(ssl,
+                part.c_str() + request_written, part.size() - request_written);
+
+            if (r == 0 || r == (size_t)-1)
+                break;
 
-        input_handle = purple_input_add(ssl->fd, PURPLE_INPUT_READ,
-            WRAPPER(LineHttpTransport::ssl_read), (gpointer)this);
+            request_written += r;
+            stats_.bytes_out += r;
+            continue;
+        }
+
+        request_written = 0;
+
+        if (request_part == 0) {
+            request_part = 1;
+        } else {
+            request_part = 0;
+            requests_written++;
+        }
+    }
+
+    if (requests_written < request_queue.size()) {
+        if (!write_handle) {
+            write_handle = purple_input_add(ssl->fd, PURPLE_INPUT_WRITE,
+                WRAPPER(LineHttpTransport::ssl_write), (gpointer)this);
+        }
+    } else if (write_handle) {
+        purple_input_remove(write_handle);
+        write_handle = 0;
     }
 }
 
@@ -243,32 +768,20 @@ void LineHttpTransport::ssl_read(gint, PurpleInputCondition) {
     bool any = false;
 
     while (true) {
-        size_t count = purple_ssl_read(ssl, (void *)buf, BUFFER_SIZE);
+        size_t count = purple_ssl_read(ssl, response_data.prepare(BUFFER_SIZE), BUFFER_SIZE);
 
         if (count == 0) {
             if (any)
                 break;
 
-            purple_debug_info("line", "Connection lost.\n");
-
-            close();
-
-            if (in_progress) {
-                if (auto_reconnect) {
-                    purple_debug_info("line", "Reconnecting in %ds...\n",
-                        reconnect_timeout);
-
-                    state = ConnectionState::RECONNECTING;
-
-                    purple_timeout_add_seconds(
-                        reconnect_timeout,
-                        WRAPPER(LineHttpTransport::reconnect_timeout_cb),
-                        (gpointer)this);
-                } else {
-                    purple_connection_error(conn, "LINE: Lost connection to server.");
-                }
+            if (!request_queue.empty() && parser.eof() == HttpParser::Result::DONE) {
+                // Response delimited by the connection closing. Not keep-alive, so this closes
+                // the connection once the response is handled.
+                process_responses();
+                return;
             }
 
+            connection_lost();
             return;
         }
 
@@ -276,129 +789,305 @@ void LineHttpTransport::ssl_read(gint, PurpleInputCondition) {
             break;
 
         any = true;
+        last_activity = g_get_monotonic_time();
+        stats_.bytes_in += count;
+
+        response_data.commit(count);
+
+        if (!process_responses())
+            break;
+    }
+}
+
+void LineHttpTransport::connection_lost() {
+    purple_debug_info("line", "Connection lost.\n");
+
+    RingQueue<Request> unsafe;
+    take_unsafe_requests(unsafe);
+
+    size_t unanswered = request_queue.size();
+    bool was_working = (responses_received > 0);
 
-        response_str.append((const char *)buf, count);
+    close();
+
+    if (unanswered > 0) {
+        if (was_working) {
+            // The server closed a working keep-alive connection with requests still on the wire.
+            // Send the unanswered ones that are safe to repeat again on a new connection right
+            // away.
+
+            purple_debug_info("line", "Replaying %d unanswered requests.\n", (int)unanswered);
+
+            send_next();
+        } else if (auto_reconnect) {
+            schedule_reconnect();
+        } else {
+            purple_connection_error(conn, "LINE: Lost connection to server.");
+        }
+    }
+
+    fail_requests(unsafe);
+}
+
+// Handles every complete response in the receive buffer. Returns false if reading should stop
+// because the connection was closed or the session died.
+bool LineHttpTransport::process_responses() {
+    while (!request_queue.empty()) {
+        HttpParser::Result result = parser.parse(response_data.data(), response_data.size());
+
+        if (result == HttpParser::Result::ERROR) {
+            purple_debug_warning("line", "Invalid HTTP response from %s\n", host.c_str());
+
+            purple_connection_error(conn, "LINE: Invalid response from server.");
+            return false;
+        }
+
+        bool compressed = parser.headers_done()
+            && parser.content_encoding() != HttpParser::Encoding::IDENTITY;
+
+        if (compressed && !inflate_body(result == HttpParser::Result::DONE)) {
+            purple_debug_warning("line", "Invalid compressed response from %s\n", host.c_str());
+
+            purple_connection_error(conn, "LINE: Invalid response from server.");
+            return false;
+        }
+
+        if (result == HttpParser::Result::NEED_MORE)
+            return true;
 
-        if (content_length_ < 0)
-            try_parse_response_header();
+        if (parser.has_x_ls())
+            x_ls = parser.x_ls();
+
+        if (parser.status_code() < 400)
+            supervisor->success();
+
+        if (parser.status_code() == 403) {
+            // Don't try to reconnect because this usually means the user has logged in from
+            // elsewhere.
+
+            // TODO: Check actual reason
 
-        if (content_length_ >= 0 && response_str.size() >= (size_t)content_length_) {
             purple_input_remove(input_handle);
             input_handle = 0;
 
-            if (status_code_ == 403) {
-                // Don't try to reconnect because this usually means the user has logged in from
-                // elsewhere.
+            conn->wants_to_die = TRUE;
+            purple_connection_error(conn, "Session died.");
+            return false;
+        }
 
-                // TODO: Check actual reason
+        // Whatever follows the decoded body in the buffer (chunk framing, trailers)
+        size_t trailing = parser.message_length() - parser.body_start() - parser.body_length();
 
-                conn->wants_to_die = TRUE;
-                purple_connection_error(conn, "Session died.");
-                return;
-            }
-
-            response_buf.str(response_str.substr(0, content_length_));
-            response_str.erase(0, content_length_);
+        response_data.consume(parser.body_start());
+        body_data = &response_data;
+        response_remaining = parser.body_length();
 
-            int connection_id_before = connection_id;
+        if (compressed) {
+            response_data.consume(parser.body_length());
+            body_data = &decoded_data;
+            response_remaining = decoded_data.size();
+        }
 
-            try {
-                request_queue.front().callback();
-            } catch (line::TalkException &err) {
-                std::string msg = "LINE: TalkException: ";
-                msg += err.reason;
+        int connection_id_before = connection_id;
 
-                purple_debug_info("line", "TalkException: %s (%d)\n",
-                    err.reason.c_str(), err.code);
+        // Taken off the queue before the callback runs, so that it isn't sent again if the
+        // callback closes the connection
+        Request req = std::move(request_queue.front());
+        request_queue.pop_front();
 
-                if (err.code == line::ErrorCode::NOT_AUTHORIZED_DEVICE) {
-                    purple_account_remove_setting(acct, LINE_ACCOUNT_AUTH_TOKEN);
+        // The next response's wait starts now
+        head_since = g_get_monotonic_time();
 
-                    if (err.reason == "AUTHENTICATION_DIVESTED_BY_OTHER_DEVICE") {
-                        msg = "LINE: You have been logged out because "
-                            "you logged in from another device.";
-                    } else if (err.reason == "REVOKE") {
-                        msg = "LINE: This device was logged out via the mobile app.";
-                    }
+        requests_written--;
+        responses_received++;
 
-                    // Don't try to reconnect so we don't fight over the session with another client
+        stats_.responses++;
 
-                    conn->wants_to_die = TRUE;
-                }
+        queue_time_ = req.waited;
+        wire_time_ = g_get_monotonic_time() - req.sent_at;
+        stats_.wire_time.add(wire_time_);
 
-                purple_connection_error(conn, msg.c_str());
-                return;
-            } catch (apache::thrift::TApplicationException &err) {
-                std::string msg = "LINE: Application error: ";
-                msg += err.what();
+        req.handle.state->done = true;
 
-                purple_connection_error(conn, msg.c_str());
-                return;
-            } catch (apache::thrift::transport::TTransportException &err) {
-                std::string msg = "LINE: Transport error: ";
-                msg += err.what();
+        if (response_hook)
+            response_hook(response_hook_data, this, req.handle);
 
-                purple_connection_error(conn, msg.c_str());
-                return;
-            }
+        if (!run_callback(req))
+            return false;
 
-            request_queue.pop();
+        // Anything the callback decoded into the arena is dead once it returns. If it threw, the
+        // memory is reused by the next response instead.
+        arena_.reset();
 
-            in_progress = false;
+        keep_buffer(req.head);
+        keep_buffer(req.body);
 
-            if (connection_id != connection_id_before)
-                break; // Callback closed connection, don't try to continue reading
+        if (connection_id != connection_id_before) {
+            // Callback closed connection, don't try to continue reading. Anything that was
+            // pipelined behind this request goes out on a new connection.
 
-            if (!keep_alive) {
-                close();
+            if (state == ConnectionState::DISCONNECTED)
                 send_next();
-                break;
-            }
 
+            return false;
+        }
+
+        // Skip whatever part of the body the callback didn't read
+        body_data->consume(response_remaining);
+        response_data.consume(trailing);
+        body_data = &response_data;
+        response_remaining = 0;
+
+        if (!parser.keep_alive()) {
+            close();
             send_next();
+            return false;
         }
+
+        reset_response();
+
+        send_next();
     }
+
+    return true;
 }
 
-void LineHttpTransport::try_parse_response_header() {
-    size_t header_end = response_str.find("\r\n\r\n");
-    if (header_end == std::string::npos)
-        return;
+// Runs the callback of a request unless it was cancelled. Returns false if the session died.
+bool LineHttpTransport::run_callback(Request &req) {
+    try {
+        if (!req.handle.cancelled())
+            req.callback();
+    } catch (line::TalkException &err) {
+        std::string msg = "LINE: TalkException: ";
+        msg += err.reason;
+
+        purple_debug_info("line", "TalkException: %s (%d)\n",
+            err.reason.c_str(), err.code);
+
+        if (err.code == line::ErrorCode::NOT_AUTHORIZED_DEVICE) {
+            purple_account_remove_setting(acct, LINE_ACCOUNT_AUTH_TOKEN);
+
+            if (err.reason == "AUTHENTICATION_DIVESTED_BY_OTHER_DEVICE") {
+                msg = "LINE: You have been logged out because "
+                    "you logged in from another device.";
+            } else if (err.reason == "REVOKE") {
+                msg = "LINE: This device was logged out via the mobile app.";
+            }
 
-    if (content_length_ == -1)
-        content_length_ = 0;
+            // Don't try to reconnect so we don't fight over the session with another client
 
-    std::istringstream stream(response_str.substr(0, header_end));
+            conn->wants_to_die = TRUE;
+        }
+
+        purple_connection_error(conn, msg.c_str());
+        return false;
+    } catch (apache::thrift::TApplicationException &err) {
+        std::string msg = "LINE: Application error: ";
+        msg += err.what();
 
-    stream.ignore(256, ' ');
-    stream >> status_code_;
-    stream.ignore(256, '\n');
+        purple_connection_error(conn, msg.c_str());
+        return false;
+    } catch (apache::thrift::transport::TTransportException &err) {
+        std::string msg = "LINE: Transport error: ";
+        msg += err.what();
 
-    while (stream) {
-        std::string name, value;
+        purple_connection_error(conn, msg.c_str());
+        return false;
+    }
 
-        std::getline(stream, name, ':');
-        std::transform(name.begin(), name.end(), name.begin(), tolower);
+    return true;
+}
 
-        stream.ignore(256, ' ');
+// Inflates whatever has arrived of the current response's compressed body into decoded_data,
+// so that the work is spread over the reads instead of done all at once at the end. done means
+// the whole body is there, in which case the stream has to end with it.
+bool LineHttpTransport::inflate_body(bool done) {
+    if (parser.content_encoding() == HttpParser::Encoding::UNKNOWN)
+        return false;
 
-        if (name == "content-length")
-            stream >> content_length_;
+    if (done && parser.body_length() == 0) {
+        decoded_data.clear();
+        return true;
+    }
 
-        if (name == "x-ls")
-            std::getline(stream, x_ls, '\r');
+    if (!inflate_started) {
+        if (!inflater_ready) {
+            memset(&inflater, 0, sizeof(inflater));
 
-        if (name == "connection") {
-            std::string value;
-            std::getline(stream, value, '\r');
-            std::transform(value.begin(), value.end(), value.begin(), tolower);
+            // Detect gzip or zlib header automatically
+            if (inflateInit2(&inflater, 15 + 32) != Z_OK)
+                return false;
 
-            if (value == "keep-alive")
-                keep_alive = true;
+            inflater_ready = true;
+        } else {
+            inflateReset(&inflater);
         }
 
-        stream.ignore(256, '\n');
+        decoded_data.clear();
+
+        inflate_started = true;
+        inflate_ended = false;
+        body_inflated = 0;
     }
 
-    response_str.erase(0, header_end + 4);
+    size_t received = parser.body_received(response_data.size());
+
+    if (!inflate_ended && received > body_inflated) {
+        // The buffer may have moved since the last read, so start from the offset again
+        inflater.next_in = response_data.data() + parser.body_start() + body_inflated;
+        inflater.avail_in = (uInt)(received - body_inflated);
+
+        while (true) {
+            size_t space = std::max(BUFFER_SIZE, (size_t)inflater.avail_in * 4);
+
+            inflater.next_out = decoded_data.prepare(space);
+            inflater.avail_out = (uInt)space;
+
+            int r = inflate(&inflater, Z_NO_FLUSH);
+
+            decoded_data.commit(space - inflater.avail_out);
+
+            if (decoded_data.size() > LINE_MAX_INFLATED_SIZE)
+                return false;
+
+            if (r == Z_STREAM_END) {
+                inflate_ended = true;
+                break;
+            }
+
+            if (r != Z_OK && r != Z_BUF_ERROR)
+                return false;
+
+            // Done with this input once zlib has room left over, otherwise it may have more
+            // output waiting
+            if (inflater.avail_out > 0) {
+                if (inflater.avail_in > 0)
+                    return false;
+
+                break;
+            }
+        }
+
+        // Anything after the end of the stream is ignored
+        body_inflated = received;
+    }
+
+    if (!done)
+        return true;
+
+    // The body ended before the stream did
+    if (!inflate_ended)
+        return false;
+
+    compressed_bytes_ += parser.body_length();
+    uncompressed_bytes_ += decoded_data.size();
+
+    return true;
+}
+
+void LineHttpTransport::reset_response() {
+    parser.reset(ls_mode);
+
+    inflate_started = false;
+    body_inflated = 0;
 }
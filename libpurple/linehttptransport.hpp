@@ -3,35 +3,66 @@
 #include <functional>
 #include <string>
 #include <sstream>
-#include <queue>
+#include <memory>
+#include <vector>
 
 #include <stdint.h>
 
+#include <zlib.h>
+
 #include <account.h>
 #include <sslconn.h>
 
 #include <thrift/transport/TTransport.h>
 
+#include "arena.hpp"
+#include "callback.hpp"
+#include "httpparser.hpp"
+#include "metrics.hpp"
+#include "readbuffer.hpp"
+#include "requesthandle.hpp"
+#include "retrysupervisor.hpp"
+#include "ringqueue.hpp"
 #include "wrapper.hpp"
 
+// Response callbacks have room for ThriftClient's bookkeeping around a Callback<void()>
+using ResponseCallback = Callback<void(), 2 * CALLBACK_INLINE_SIZE>;
+
 class LineHttpTransport : public apache::thrift::transport::TTransport {
 
     enum class ConnectionState {
         DISCONNECTED = 0,
         CONNECTED = 1,
         RECONNECTING = 2,
+        CONNECTING = 3,
     };
 
     class Request {
     public:
-        std::string method;
-        std::string path;
-        std::string content_type;
+        // method, path and content_type are string constants, so that queueing a request doesn't
+        // allocate. content_params are appended to the content type and usually empty.
+        const char *method;
+        const char *path;
+        const char *content_type;
+        std::string content_params;
+        std::string head;
         std::string body;
-        std::function<void()> callback;
+        ResponseCallback callback;
+        RequestPriority priority;
+        RequestHandle handle;
+        gint64 queued_at;
+        gint64 waited;
+        gint64 sent_at;
+        int timeout;
+        int attempts;
+
+        // Can be sent again after it's been written, because doing it twice does no harm
+        bool idempotent;
     };
 
     static const size_t BUFFER_SIZE = 4096;
+    static const size_t SPARE_BUFFERS = 8;
+    static const int PRIORITY_COUNT = 3;
 
     PurpleAccount *acct;
     PurpleConnection *conn;
@@ -45,28 +76,97 @@ class LineHttpTransport : public apache::thrift::transport::TTransport {
 
     bool auto_reconnect;
     guint reconnect_timeout_handle;
-    int reconnect_timeout;
+    std::shared_ptr<RetrySupervisor> supervisor;
 
     PurpleSslConnection *ssl;
     guint input_handle;
+    guint write_handle;
+    guint deadline_handle;
     int connection_id;
 
-    uint8_t buf[BUFFER_SIZE];
+    // Seconds to wait for the response to a request once it's at the head of request_queue. The
+    // wait starts over whenever anything is received, so a large response that keeps arriving
+    // doesn't time out.
+    int request_timeout;
+
+    // Seconds the connection may go without receiving anything while requests are on the wire,
+    // or 0 for no limit
+    int idle_timeout;
+    gint64 last_activity;
+
+    // When the request at the head of request_queue got there
+    gint64 head_since;
+
+    // Set while the callback of a request that was given up on runs
+    bool failing;
+
+    // Body of the next request as written by Thrift
+    std::string request_body;
 
-    std::stringbuf request_buf;
+    // Heads and bodies of answered requests, kept for their capacity
+    std::vector<std::string> spare_buffers;
 
+    // Tells LineHttpPool which lane the response whose callback is about to run came from, and
+    // which request it answers
+    void (*response_hook)(gpointer data, LineHttpTransport *transport,
+        const RequestHandle &handle);
+    gpointer response_hook_data;
+
+    // Headers that are the same for every request on this connection, and the X-LS value they
+    // were built for
+    std::string header_block;
+    std::string header_block_x_ls;
+
+    // Write position: requests_written whole requests, then request_written bytes into the head
+    // (request_part 0) or the body (request_part 1) of the next one
+    size_t requests_written;
+    int request_part;
     size_t request_written;
-    std::string request_data;
 
-    bool in_progress;
-    std::string response_str;
-    std::stringbuf response_buf;
+    // Maximum number of requests on the wire at once. Only used for keep-alive connections.
+    size_t pipeline_depth;
+
+    int responses_received;
+
+    // Received data. While a response callback runs, the first response_remaining bytes of
+    // body_data are the unread part of its body, which Thrift reads in place through
+    // borrow_virt/consume_virt. body_data is response_data itself, or decoded_data if the body
+    // was compressed.
+    ReadBuffer response_data;
+    ReadBuffer decoded_data;
+    ReadBuffer *body_data;
+    size_t response_remaining;
+
+    // Advertise and decode gzip/deflate response bodies. A compressed body is inflated as it
+    // arrives. body_inflated is how much of the current one has been fed to the inflater.
+    bool compression;
+    z_stream inflater;
+    bool inflater_ready;
+    bool inflate_started;
+    bool inflate_ended;
+    size_t body_inflated;
 
-    std::queue<Request> request_queue;
+    // Body bytes of compressed responses as received and after decompressing
+    uint64_t compressed_bytes_;
+    uint64_t uncompressed_bytes_;
 
-    bool keep_alive;
-    int status_code_;
-    int content_length_;
+    TransportStats stats_;
+
+    // Scratch memory for whatever is decoded from the response whose callback is running. Reset
+    // when the callback returns.
+    Arena arena_;
+
+    // Times of the response whose callback is running
+    gint64 queue_time_;
+    gint64 wire_time_;
+
+    // Requests on the wire, in the order their responses will arrive
+    RingQueue<Request> request_queue;
+
+    // Requests waiting to be sent, by priority
+    RingQueue<Request> pending[PRIORITY_COUNT];
+
+    HttpParser parser;
 
 public:
 
@@ -76,33 +176,86 @@ public:
     ~LineHttpTransport();
 
     void set_auto_reconnect(bool auto_reconnect);
+    void set_pipeline_depth(size_t depth);
+    void set_timeout(int seconds);
+    void set_idle_timeout(int seconds);
+    void set_supervisor(std::shared_ptr<RetrySupervisor> supervisor);
+    void set_compression(bool compression);
 
     virtual void open();
     virtual void close();
 
     virtual uint32_t read_virt(uint8_t *buf, uint32_t len);
     virtual void write_virt(const uint8_t *buf, uint32_t len);
-
-    void request(std::string method, std::string path, std::string content_type,
-        std::function<void()> callback);
+    virtual const uint8_t *borrow_virt(uint8_t *buf, uint32_t *len);
+    virtual void consume_virt(uint32_t len);
+
+    // method, path and content_type have to be string constants. content_params are appended to
+    // the content type, for things like a multipart boundary.
+    RequestHandle request(const char *method, const char *path, const char *content_type,
+        ResponseCallback callback);
+    RequestHandle request(const char *method, const char *path, const char *content_type,
+        std::string body, ResponseCallback callback);
+    RequestHandle request(RequestPriority priority,
+        const char *method, const char *path, const char *content_type,
+        std::string content_params, std::string body, bool idempotent,
+        ResponseCallback callback);
+
+    void set_response_hook(
+        void (*hook)(gpointer data, LineHttpTransport *transport, const RequestHandle &handle),
+        gpointer data);
+
+    // Gives an empty buffer the capacity of one no longer in use, if there is one
+    void reuse_buffer(std::string &buf);
     int status_code();
     int content_length();
 
-    //virtual const uin8_t* borrow_virt(uint8_t *buf, uint32_t *len);
-    //virtual void consume_virt(uint32_t len);
+    // True while the callback of a request runs that won't be answered, because the connection
+    // was lost after it was written and it isn't safe to send again. There's no response, so
+    // status_code() is 0 and the body is empty unless one is put there with substitute_body().
+    bool failed() const { return failing; }
+    void substitute_body(const std::string &body);
+
+    const TransportStats &stats() const { return stats_; }
+    gint64 queue_time() const { return queue_time_; }
+    gint64 wire_time() const { return wire_time_; }
+
+    // For decoding the response whose callback is running, reset when the callback returns
+    Arena &arena() { return arena_; }
+
+    uint64_t compressed_bytes() const { return compressed_bytes_; }
+    uint64_t uncompressed_bytes() const { return uncompressed_bytes_; }
+
+    // Number of requests that a new request of the given priority would have to wait for
+    size_t queue_size(RequestPriority priority=RequestPriority::BACKGROUND) const;
 
 private:
 
-    void write_request();
+    const std::string &static_headers();
+    void write_request(Request &req);
+    void keep_buffer(std::string &buf);
 
+    void set_socket_options();
     void ssl_connect(PurpleSslConnection *, PurpleInputCondition);
     void ssl_error(PurpleSslConnection *, PurpleSslErrorType err);
     void ssl_write(int, PurpleInputCondition);
     void ssl_read(int, PurpleInputCondition);
 
     int reconnect_timeout_cb();
+    int deadline_cb();
+    void arm_deadline();
+    gint64 head_deadline() const;
 
+    RingQueue<Request> *next_pending();
     void send_next();
-
-    void try_parse_response_header();
+    void connection_lost();
+    void schedule_reconnect();
+    void reconnect();
+    void take_unsafe_requests(RingQueue<Request> &unsafe);
+    void fail_requests(RingQueue<Request> &failed);
+
+    bool process_responses();
+    bool run_callback(Request &req);
+    bool inflate_body(bool done);
+    void reset_response();
 };
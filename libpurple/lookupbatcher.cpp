@@ -0,0 +1,130 @@
+#include <debug.h>
+#include <eventloop.h>
+
+#include "constants.hpp"
+#include "lookupbatcher.hpp"
+#include "wrapper.hpp"
+
+LookupBatcher::LookupBatcher(std::shared_ptr<ThriftClient> client) :
+    client(client),
+    flush_handle(0),
+    stats_()
+{
+}
+
+LookupBatcher::~LookupBatcher() {
+    if (flush_handle)
+        purple_timeout_remove(flush_handle);
+}
+
+void LookupBatcher::get_contact(std::string mid, ContactCallback callback,
+    RequestPriority priority)
+{
+    add(contacts, std::move(mid), std::move(callback), priority);
+}
+
+void LookupBatcher::get_group(std::string id, GroupCallback callback, RequestPriority priority) {
+    add(groups, std::move(id), std::move(callback), priority);
+}
+
+template <typename T>
+void LookupBatcher::add(Pending<T> &pending, std::string id, Callback<void(T &)> callback,
+    RequestPriority priority)
+{
+    stats_.lookups++;
+
+    pending.waiting[std::move(id)].push_back(std::move(callback));
+
+    if (priority < pending.priority)
+        pending.priority = priority;
+
+    // Interactive lookups don't wait for the window, but anything else waiting goes with them
+    if (priority == RequestPriority::INTERACTIVE
+        || pending.waiting.size() >= LINE_LOOKUP_BATCH_MAX)
+    {
+        flush();
+    } else if (!flush_handle) {
+        flush_handle = purple_timeout_add(LINE_LOOKUP_WINDOW,
+            WRAPPER(LookupBatcher::flush_timeout_cb), (gpointer)this);
+    }
+}
+
+int LookupBatcher::flush_timeout_cb() {
+    flush_handle = 0;
+
+    flush();
+
+    return FALSE;
+}
+
+void LookupBatcher::flush() {
+    if (flush_handle) {
+        purple_timeout_remove(flush_handle);
+        flush_handle = 0;
+    }
+
+    flush(contacts, &ThriftClient::send_getContacts, &ThriftClient::recv_getContacts,
+        &line::Contact::mid);
+    flush(groups, &ThriftClient::send_getGroups, &ThriftClient::recv_getGroups,
+        &line::Group::id);
+}
+
+template <typename T>
+void LookupBatcher::flush(Pending<T> &pending,
+    void (line::TalkServiceClient::*send)(const std::vector<std::string> &),
+    void (line::TalkServiceClient::*recv)(std::vector<T> &),
+    std::string T::*id)
+{
+    if (pending.waiting.empty())
+        return;
+
+    auto batch = std::make_shared<Pending<T>>();
+    std::swap(*batch, pending);
+    pending.priority = RequestPriority::BACKGROUND;
+
+    std::vector<std::string> ids;
+    ids.reserve(batch->waiting.size());
+
+    for (auto &i: batch->waiting)
+        ids.push_back(i.first);
+
+    stats_.batches++;
+
+    ((*client).*send)(ids);
+    client->send(batch->priority, [this, batch, recv, id]() {
+        std::vector<T> results;
+
+        try {
+            ((*client).*recv)(results);
+        } catch (line::TalkException &err) {
+            // Still call back so that nobody waits forever
+            purple_debug_warning("line", "Batched lookup of %u ids failed: %s\n",
+                (unsigned)batch->waiting.size(), err.reason.c_str());
+        }
+
+        // The last callback for an id gets the result itself, any others a copy, so that each
+        // can move out of it.
+        auto deliver = [](std::vector<Callback<void(T &)>> &callbacks, T &value) {
+            for (size_t i = 0; i + 1 < callbacks.size(); i++) {
+                T copy(value);
+                callbacks[i](copy);
+            }
+
+            callbacks.back()(value);
+        };
+
+        for (T &result: results) {
+            auto waiting = batch->waiting.find(result.*id);
+            if (waiting == batch->waiting.end())
+                continue;
+
+            deliver(waiting->second, result);
+            batch->waiting.erase(waiting);
+        }
+
+        for (auto &i: batch->waiting) {
+            T none;
+            deliver(i.second, none);
+        }
+    });
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "thriftclient.hpp"
+
+struct LookupStats {
+    // Ids asked for, and the getContacts/getGroups calls made for them
+    uint64_t lookups;
+    uint64_t batches;
+};
+
+// Collects contact and group lookups made within a short window and sends them as one getContacts
+// or getGroups call, instead of a getContact or getGroup call each. Every callback for an id gets
+// the result, or an empty object if the server didn't return one, and may move out of it.
+class LookupBatcher {
+
+public:
+
+    using ContactCallback = Callback<void(line::Contact &)>;
+    using GroupCallback = Callback<void(line::Group &)>;
+
+private:
+
+    template <typename T>
+    struct Pending {
+        std::map<std::string, std::vector<Callback<void(T &)>>> waiting;
+        RequestPriority priority;
+
+        Pending() : priority(RequestPriority::BACKGROUND) { }
+    };
+
+    std::shared_ptr<ThriftClient> client;
+
+    Pending<line::Contact> contacts;
+    Pending<line::Group> groups;
+
+    guint flush_handle;
+
+    LookupStats stats_;
+
+    template <typename T>
+    void add(Pending<T> &pending, std::string id, Callback<void(T &)> callback,
+        RequestPriority priority);
+
+    template <typename T>
+    void flush(Pending<T> &pending,
+        void (line::TalkServiceClient::*send)(const std::vector<std::string> &),
+        void (line::TalkServiceClient::*recv)(std::vector<T> &),
+        std::string T::*id);
+
+    int flush_timeout_cb();
+
+public:
+
+    LookupBatcher(std::shared_ptr<ThriftClient> client);
+    ~LookupBatcher();
+
+    void get_contact(std::string mid, ContactCallback callback,
+        RequestPriority priority=RequestPriority::BACKGROUND);
+    void get_group(std::string id, GroupCallback callback,
+        RequestPriority priority=RequestPriority::BACKGROUND);
+
+    // Sends everything that's waiting right away
+    void flush();
+
+    const LookupStats &stats() const { return stats_; }
+
+};
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <sstream>
+
+#include <string.h>
+
+#include "metrics.hpp"
+
+Histogram::Histogram() :
+    count_(0),
+    sum(0),
+    max_(0)
+{
+    memset(buckets, 0, sizeof(buckets));
+}
+
+void Histogram::add(gint64 usec) {
+    if (usec < 0)
+        usec = 0;
+
+    buckets[std::min((int)g_bit_storage((gulong)usec), BUCKETS - 1)]++;
+
+    count_++;
+    sum += usec;
+    max_ = std::max(max_, usec);
+}
+
+void Histogram::merge(const Histogram &other) {
+    for (int i = 0; i < BUCKETS; i++)
+        buckets[i] += other.buckets[i];
+
+    count_ += other.count_;
+    sum += other.sum;
+    max_ = std::max(max_, other.max_);
+}
+
+gint64 Histogram::percentile(double p) const {
+    if (count_ == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(count_ * p / 100.0);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += buckets[i];
+
+        if (seen > rank)
+            return std::min((gint64)1 << i, max_);
+    }
+
+    return max_;
+}
+
+static void write_ms(std::ostream &out, gint64 usec) {
+    out << usec / 1000 << "." << (usec % 1000) / 100 << "ms";
+}
+
+std::string Histogram::summary() const {
+    std::ostringstream out;
+
+    out << "n=" << count_ << " mean=";
+    write_ms(out, mean());
+    out << " p50<";
+    write_ms(out, percentile(50));
+    out << " p99<";
+    write_ms(out, percentile(99));
+    out << " max=";
+    write_ms(out, max_);
+
+    return out.str();
+}
+
+RollingHistogram::RollingHistogram(gint64 window) :
+    window(window),
+    window_start(0)
+{
+}
+
+void RollingHistogram::rotate(gint64 now) {
+    if (now - window_start < window)
+        return;
+
+    previous = (now - window_start < 2 * window) ? current : Histogram();
+    current = Histogram();
+    window_start = now;
+}
+
+void RollingHistogram::add(gint64 now, gint64 usec) {
+    rotate(now);
+
+    current.add(usec);
+}
+
+Histogram RollingHistogram::snapshot(gint64 now) {
+    rotate(now);
+
+    Histogram r = previous;
+    r.merge(current);
+
+    return r;
+}
+
+TransportStats::TransportStats() :
+    requests(0),
+    responses(0),
+    bytes_in(0),
+    bytes_out(0),
+    connects(0),
+    reconnects(0),
+    timeouts(0),
+    queue_high_water(0)
+{
+}
+
+void TransportStats::merge(const TransportStats &other) {
+    requests += other.requests;
+    responses += other.responses;
+    bytes_in += other.bytes_in;
+    bytes_out += other.bytes_out;
+    connects += other.connects;
+    reconnects += other.reconnects;
+    timeouts += other.timeouts;
+    queue_high_water = std::max(queue_high_water, other.queue_high_water);
+
+    queue_time.merge(other.queue_time);
+    wire_time.merge(other.wire_time);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glib.h>
+
+// Latency histogram with one bucket per power of two microseconds. Adding a sample is a couple of
+// instructions and it never allocates, so these stay on all the time.
+class Histogram {
+
+    static const int BUCKETS = 32;
+
+    uint64_t buckets[BUCKETS];
+    uint64_t count_;
+    gint64 sum;
+    gint64 max_;
+
+public:
+
+    Histogram();
+
+    void add(gint64 usec);
+    void merge(const Histogram &other);
+
+    uint64_t count() const { return count_; }
+    gint64 total() const { return sum; }
+    gint64 mean() const { return count_ ? sum / (gint64)count_ : 0; }
+    gint64 max() const { return max_; }
+
+    // Upper bound of the bucket the given percentile (0-100) falls in
+    gint64 percentile(double p) const;
+
+    // Bucket i holds samples below 2^i microseconds, except for the last one which holds the rest
+    static int bucket_count() { return BUCKETS; }
+    uint64_t bucket(int i) const { return buckets[i]; }
+
+    // e.g. "n=12 mean=3.1ms p50<4.1ms p99<16.4ms max=15.0ms"
+    std::string summary() const;
+
+};
+
+// Histogram of recent samples only. Samples go into the current window, and the previous window is
+// kept so that a snapshot always covers between one and two windows' worth.
+class RollingHistogram {
+
+    gint64 window;
+    gint64 window_start;
+
+    Histogram current;
+    Histogram previous;
+
+    void rotate(gint64 now);
+
+public:
+
+    RollingHistogram(gint64 window);
+
+    // Times are from g_get_monotonic_time()
+    void add(gint64 now, gint64 usec);
+    Histogram snapshot(gint64 now);
+
+};
+
+// Counters for one connection or set of connections. Times are split into the time a request
+// waited to be sent and the time from sending it to the response.
+struct TransportStats {
+    uint64_t requests;
+    uint64_t responses;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t connects;
+    uint64_t reconnects;
+    uint64_t timeouts;
+    size_t queue_high_water;
+
+    Histogram queue_time;
+    Histogram wire_time;
+
+    TransportStats();
+
+    void merge(const TransportStats &other);
+};
+
+struct CallStats {
+    uint64_t calls;
+
+    Histogram queue_time;
+    Histogram wire_time;
+
+    CallStats() : calls(0) {}
+};
@@ -0,0 +1,289 @@
+#include <sstream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <debug.h>
+
+#include "constants.hpp"
+#include "metricsexporter.hpp"
+#include "purpleline.hpp"
+#include "wrapper.hpp"
+
+static std::string escape_label(const std::string &value) {
+    std::string r;
+
+    for (char c: value) {
+        if (c == '\\' || c == '"')
+            r += '\\';
+
+        if (c == '\n')
+            r += "\\n";
+        else
+            r += c;
+    }
+
+    return r;
+}
+
+static std::string format_labels(const MetricsWriter::Labels &labels,
+    const char *extra_name=nullptr, const std::string &extra_value="")
+{
+    if (labels.empty() && !extra_name)
+        return "";
+
+    std::string r = "{";
+
+    for (auto &l: labels) {
+        if (r.size() > 1)
+            r += ",";
+
+        r += l.first + "=\"" + escape_label(l.second) + "\"";
+    }
+
+    if (extra_name) {
+        if (r.size() > 1)
+            r += ",";
+
+        r += std::string(extra_name) + "=\"" + extra_value + "\"";
+    }
+
+    return r + "}";
+}
+
+static std::string format_value(double value) {
+    std::ostringstream ss;
+    ss << value;
+    return ss.str();
+}
+
+MetricsWriter::Family &MetricsWriter::family(const std::string &name,
+    const char *type, const char *help)
+{
+    Family &f = families[name];
+
+    if (f.type.empty()) {
+        f.type = type;
+        f.help = help;
+    }
+
+    return f;
+}
+
+void MetricsWriter::counter(const std::string &name, const char *help, const Labels &labels,
+    double value)
+{
+    family(name, "counter", help).samples.push_back(
+        name + format_labels(labels) + " " + format_value(value));
+}
+
+void MetricsWriter::gauge(const std::string &name, const char *help, const Labels &labels,
+    double value)
+{
+    family(name, "gauge", help).samples.push_back(
+        name + format_labels(labels) + " " + format_value(value));
+}
+
+void MetricsWriter::histogram(const std::string &name, const char *help, const Labels &labels,
+    const Histogram &hist)
+{
+    Family &f = family(name, "histogram", help);
+
+    uint64_t cumulative = 0;
+
+    for (int i = 0; i < Histogram::bucket_count() - 1; i++) {
+        cumulative += hist.bucket(i);
+
+        f.samples.push_back(name + "_bucket"
+            + format_labels(labels, "le", format_value((double)((gint64)1 << i) / 1e6))
+            + " " + format_value((double)cumulative));
+    }
+
+    f.samples.push_back(name + "_bucket" + format_labels(labels, "le", "+Inf")
+        + " " + format_value((double)hist.count()));
+    f.samples.push_back(name + "_sum" + format_labels(labels)
+        + " " + format_value((double)hist.total() / 1e6));
+    f.samples.push_back(name + "_count" + format_labels(labels)
+        + " " + format_value((double)hist.count()));
+}
+
+std::string MetricsWriter::str() const {
+    std::string r;
+
+    for (auto &i: families) {
+        r += "# HELP " + i.first + " " + i.second.help + "\n";
+        r += "# TYPE " + i.first + " " + i.second.type + "\n";
+
+        for (const std::string &sample: i.second.samples)
+            r += sample + "\n";
+    }
+
+    return r;
+}
+
+MetricsExporter::Client::Client(MetricsExporter &exporter, int fd) :
+    exporter(exporter),
+    fd(fd),
+    written(0)
+{
+    handle = purple_input_add(fd, PURPLE_INPUT_READ,
+        WRAPPER(MetricsExporter::Client::read_cb), (gpointer)this);
+}
+
+MetricsExporter::Client::~Client() {
+    purple_input_remove(handle);
+    ::close(fd);
+}
+
+// Waits for the end of the request headers or the end of input, whichever comes first
+void MetricsExporter::Client::read_cb(int, PurpleInputCondition) {
+    char buf[1024];
+
+    ssize_t r = read(fd, buf, sizeof(buf));
+
+    if (r < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return;
+
+        exporter.close_client(this);
+        return;
+    }
+
+    request.append(buf, r);
+
+    if (r > 0 && request.find("\r\n\r\n") == std::string::npos) {
+        if (request.size() > 8192)
+            exporter.close_client(this);
+
+        return;
+    }
+
+    std::string body = MetricsExporter::collect();
+
+    if (request.compare(0, 4, "GET ") == 0) {
+        response =
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "\r\n";
+    }
+
+    response += body;
+
+    purple_input_remove(handle);
+    handle = purple_input_add(fd, PURPLE_INPUT_WRITE,
+        WRAPPER(MetricsExporter::Client::write_cb), (gpointer)this);
+}
+
+void MetricsExporter::Client::write_cb(int, PurpleInputCondition) {
+    ssize_t r = write(fd, response.c_str() + written, response.size() - written);
+
+    if (r < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    if (r > 0)
+        written += r;
+
+    if (r <= 0 || written == response.size())
+        exporter.close_client(this);
+}
+
+MetricsExporter::MetricsExporter(std::string path) :
+    path(path),
+    fd(-1),
+    handle(0)
+{
+    struct sockaddr_un addr;
+
+    if (path.size() >= sizeof(addr.sun_path)) {
+        purple_debug_warning("line", "Metrics socket path is too long: %s\n", path.c_str());
+        return;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        purple_debug_warning("line", "Metrics socket: %s\n", strerror(errno));
+        return;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    // Left over from an earlier process
+    unlink(path.c_str());
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 8) == -1) {
+        purple_debug_warning("line", "Metrics socket %s: %s\n", path.c_str(), strerror(errno));
+
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+
+    handle = purple_input_add(fd, PURPLE_INPUT_READ,
+        WRAPPER(MetricsExporter::accept_cb), (gpointer)this);
+
+    purple_debug_info("line", "Serving metrics on %s\n", path.c_str());
+}
+
+MetricsExporter::~MetricsExporter() {
+    for (Client *client: clients)
+        delete client;
+
+    if (fd != -1) {
+        purple_input_remove(handle);
+        ::close(fd);
+        unlink(path.c_str());
+    }
+}
+
+MetricsExporter *MetricsExporter::from_env() {
+    const char *path = g_getenv(LINE_METRICS_SOCKET_ENV);
+
+    if (!path || !*path)
+        return nullptr;
+
+    return new MetricsExporter(path);
+}
+
+void MetricsExporter::accept_cb(int, PurpleInputCondition) {
+    int client_fd = accept(fd, nullptr, nullptr);
+    if (client_fd == -1)
+        return;
+
+    fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) | O_NONBLOCK);
+
+    clients.insert(new Client(*this, client_fd));
+}
+
+void MetricsExporter::close_client(Client *client) {
+    clients.erase(client);
+    delete client;
+}
+
+std::string MetricsExporter::collect() {
+    MetricsWriter writer;
+
+    // Accounts that are still logging in or failed to don't count
+    size_t accounts = 0;
+
+    for (PurpleLine *line: PurpleLine::instances) {
+        if (line->logged_in())
+            accounts++;
+    }
+
+    writer.gauge("line_accounts", "Number of accounts that have finished logging in.", {},
+        (double)accounts);
+
+    for (PurpleLine *line: PurpleLine::instances)
+        line->collect_metrics(writer);
+
+    return writer.str();
+}
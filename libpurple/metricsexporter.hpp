@@ -0,0 +1,88 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <eventloop.h>
+
+#include "metrics.hpp"
+
+// Collects samples in the Prometheus text format. Samples of the same metric may be added in any
+// order and are grouped under one HELP/TYPE header.
+class MetricsWriter {
+
+    struct Family {
+        std::string type;
+        std::string help;
+        std::vector<std::string> samples;
+    };
+
+    std::map<std::string, Family> families;
+
+    Family &family(const std::string &name, const char *type, const char *help);
+
+public:
+
+    // labels is a list of name, value pairs
+    using Labels = std::vector<std::pair<std::string, std::string>>;
+
+    void counter(const std::string &name, const char *help, const Labels &labels, double value);
+    void gauge(const std::string &name, const char *help, const Labels &labels, double value);
+
+    // Recorded in seconds
+    void histogram(const std::string &name, const char *help, const Labels &labels,
+        const Histogram &hist);
+
+    std::string str() const;
+
+};
+
+class PurpleLine;
+
+// Serves metrics of all accounts over a UNIX socket, one scrape per connection. Clients may send an
+// HTTP request or nothing at all and just close their end for writing.
+class MetricsExporter {
+
+    class Client {
+        MetricsExporter &exporter;
+        int fd;
+        guint handle;
+
+        std::string request;
+        std::string response;
+        size_t written;
+
+    public:
+
+        Client(MetricsExporter &exporter, int fd);
+        ~Client();
+
+        void read_cb(int, PurpleInputCondition);
+        void write_cb(int, PurpleInputCondition);
+    };
+
+    std::string path;
+    int fd;
+    guint handle;
+
+    std::set<Client *> clients;
+
+    void accept_cb(int, PurpleInputCondition);
+    void close_client(Client *client);
+
+    MetricsExporter(std::string path);
+
+public:
+
+    ~MetricsExporter();
+
+    // Returns null unless the socket path is set in the environment
+    static MetricsExporter *from_env();
+
+    static std::string collect();
+
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+
+#include "requesthandle.hpp"
+
+// Which lane the last request with each ordering key went to, kept while that request is
+// outstanding so that the next one with the key follows it there. Only a few keys are outstanding
+// at a time, so they're kept in a list that's searched linearly. Entries whose request is done
+// are reused along with the capacity of their key, so that steady use doesn't allocate.
+class OrderedKeys {
+
+    struct Entry {
+        std::string key;
+        size_t lane;
+        RequestHandle last;
+    };
+
+    std::vector<Entry> entries;
+
+public:
+
+    // Returns false if no request with the key is outstanding
+    bool find(const std::string &key, size_t &lane) const {
+        for (const Entry &entry : entries) {
+            if (!entry.last.done() && entry.key == key) {
+                lane = entry.lane;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void sent(const std::string &key, size_t lane, const RequestHandle &handle) {
+        Entry *free_entry = nullptr;
+
+        for (Entry &entry : entries) {
+            if (entry.last.done()) {
+                if (!free_entry)
+                    free_entry = &entry;
+            } else if (entry.key == key) {
+                entry.lane = lane;
+                entry.last = handle;
+                return;
+            }
+        }
+
+        if (!free_entry) {
+            entries.push_back(Entry());
+            free_entry = &entries.back();
+        }
+
+        free_entry->key.assign(key);
+        free_entry->lane = lane;
+        free_entry->last = handle;
+    }
+
+    // Frees the entry of a key whose last request was just answered
+    void answered(const RequestHandle &handle) {
+        for (Entry &entry : entries) {
+            if (entry.last == handle) {
+                entry.last = RequestHandle();
+                return;
+            }
+        }
+    }
+
+    void clear() {
+        for (Entry &entry : entries)
+            entry.last = RequestHandle();
+    }
+
+};
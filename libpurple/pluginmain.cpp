@@ -1,6 +1,7 @@
 #include <glib.h>
 
 #include <account.h>
+#include <accountopt.h>
 #include <debug.h>
 #include <prpl.h>
 #include <version.h>
@@ -15,6 +16,8 @@ static PurplePluginProtocolInfo prpl_info;
 
 static PurplePluginInfo info;
 
+static MetricsExporter *metrics_exporter = nullptr;
+
 static void init_icon_spec(PurpleBuddyIconSpec &s) {
     s.format = (char *)"jpeg";
     s.min_width = 0;
@@ -64,6 +67,24 @@ static void init_prpl_info(PurplePluginProtocolInfo &i) {
     i.chat_send = WRAPPER(PurpleLine::chat_send);
     i.find_blist_chat = WRAPPER(PurpleLine::find_blist_chat);
 
+    i.protocol_options = g_list_append(i.protocol_options,
+        purple_account_option_string_new(
+            "Trace file (Chrome trace format, for debugging)", LINE_ACCOUNT_TRACE_FILE, ""));
+
+    i.protocol_options = g_list_append(i.protocol_options,
+        purple_account_option_int_new(
+            "Warn when message delivery p99 exceeds (ms)", LINE_ACCOUNT_DELIVERY_WARNING,
+            LINE_DELIVERY_WARNING_DEFAULT));
+
+    i.protocol_options = g_list_append(i.protocol_options,
+        purple_account_option_bool_new(
+            "Decode received operations on a separate thread", LINE_ACCOUNT_DECODE_THREAD,
+            FALSE));
+
+    i.protocol_options = g_list_append(i.protocol_options,
+        purple_account_option_bool_new(
+            "Accept compressed responses", LINE_ACCOUNT_COMPRESSION, TRUE));
+
     i.struct_size = sizeof(PurplePluginProtocolInfo);
 }
 
@@ -71,6 +92,9 @@ static void line_plugin_destroy(PurplePlugin *plugin) {
     (void)plugin;
 
     purple_debug_info("line", "shutting down\n");
+
+    delete metrics_exporter;
+    metrics_exporter = nullptr;
 }
 
 static void line_plugin_init(PurplePlugin *plugin) {
@@ -80,6 +104,8 @@ static void line_plugin_init(PurplePlugin *plugin) {
     init_prpl_info(prpl_info);
 
     PurpleLine::register_commands();
+
+    metrics_exporter = MetricsExporter::from_env();
 }
 
 extern "C" {
@@ -0,0 +1,186 @@
+#include <system_error>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include <debug.h>
+
+#include <thrift/transport/TTransportException.h>
+
+#include "polldecoder.hpp"
+#include "wrapper.hpp"
+
+PollDecoder::PollDecoder(DecodedFunc decoded) :
+    decoded(decoded),
+    stopping(false),
+    notify_read(-1),
+    notify_write(-1),
+    input_handle(0)
+{
+}
+
+PollDecoder::~PollDecoder() {
+    stop();
+}
+
+bool PollDecoder::open_notify() {
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) {
+        purple_debug_warning("line", "Couldn't create eventfd: %s\n", strerror(errno));
+        return false;
+    }
+
+    notify_read = notify_write = fd;
+#else
+    int fds[2];
+    if (pipe(fds) == -1) {
+        purple_debug_warning("line", "Couldn't create pipe: %s\n", strerror(errno));
+        return false;
+    }
+
+    for (int fd: fds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    notify_read = fds[0];
+    notify_write = fds[1];
+#endif
+
+    return true;
+}
+
+void PollDecoder::close_notify() {
+    if (notify_write != notify_read)
+        close(notify_write);
+
+    close(notify_read);
+
+    notify_read = notify_write = -1;
+}
+
+bool PollDecoder::start() {
+    if (running())
+        return true;
+
+    if (!open_notify())
+        return false;
+
+    stopping = false;
+
+    try {
+        worker = std::thread(&PollDecoder::run, this);
+    } catch (std::system_error &err) {
+        purple_debug_warning("line", "Couldn't start decoder thread: %s\n", err.what());
+
+        close_notify();
+        return false;
+    }
+
+    input_handle = purple_input_add(notify_read, PURPLE_INPUT_READ,
+        WRAPPER(PollDecoder::decoded_cb), (gpointer)this);
+
+    return true;
+}
+
+void PollDecoder::stop() {
+    if (!running())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    wake.notify_one();
+    worker.join();
+
+    purple_input_remove(input_handle);
+    input_handle = 0;
+
+    close_notify();
+
+    // Whatever was still queued is dropped along with the poll it belonged to
+    std::unique_ptr<PollBatch> batch;
+    while (to_worker.pop(batch)) { }
+    while (from_worker.pop(batch)) { }
+}
+
+bool PollDecoder::submit(std::unique_ptr<PollBatch> &batch) {
+    if (!running() || !to_worker.push(std::move(batch)))
+        return false;
+
+    // Taking the lock makes sure the worker either sees the batch or is already waiting
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+
+    wake.notify_one();
+    return true;
+}
+
+void PollDecoder::run() {
+    std::unique_ptr<PollBatch> batch;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || !to_worker.empty(); });
+
+            if (stopping)
+                return;
+        }
+
+        while (to_worker.pop(batch)) {
+            decode(*batch);
+
+            // Can't be full, as there are never more batches than fit in one queue
+            from_worker.push(std::move(batch));
+
+            // Can only fail if the counter overflows or the pipe is full, and then the main loop
+            // is woken up anyway. eventfd takes exactly eight bytes, a pipe doesn't mind.
+            uint64_t one = 1;
+            ssize_t written = write(notify_write, &one, sizeof(one));
+            (void)written;
+        }
+    }
+}
+
+void PollDecoder::decode(PollBatch &batch) {
+    try {
+        size_t used = decode_fetch_operations_reply(
+            (const uint8_t *)batch.reply.data(), batch.reply.size(), batch.operations);
+
+        if (used == 0) {
+            batch.error = "Not a fetchOperations result";
+            return;
+        }
+
+        // Messages are otherwise decoded when first accessed, which would be on the main loop
+        for (const OperationView &op: batch.operations) {
+            if (op.__isset.message)
+                op.message();
+        }
+    } catch (apache::thrift::transport::TTransportException &err) {
+        batch.operations.clear();
+        batch.error = err.what();
+    }
+}
+
+void PollDecoder::decoded_cb(gint fd, PurpleInputCondition) {
+    // Resets the eventfd counter in one read, or empties the pipe
+    uint64_t buf[8];
+    while (read(fd, buf, sizeof(buf)) > 0) { }
+
+    std::unique_ptr<PollBatch> batch;
+    while (from_worker.pop(batch))
+        decoded(*batch);
+}
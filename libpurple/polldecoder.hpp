@@ -0,0 +1,86 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <eventloop.h>
+
+#include "arena.hpp"
+#include "spscqueue.hpp"
+#include "thriftview.hpp"
+
+// A fetchOperations reply copied out of its response, and the operations decoded from it. The
+// operations point into reply and are allocated from arena, so they live as long as the batch.
+struct PollBatch {
+    std::string reply;
+    Arena arena;
+    OperationList operations;
+
+    // Set if the reply couldn't be decoded
+    std::string error;
+
+    PollBatch() : operations(OperationList::allocator_type(&arena)) { }
+};
+
+// Decodes poll replies on a worker thread, so that large batches don't hold up the main loop. The
+// worker only decodes. Reading the response happens on the main loop as before, and decoded batches
+// are handed back to it through a queue and an eventfd (a pipe where there's no eventfd) watched
+// with purple_input_add, so callbacks and everything they do stay on the main thread.
+class PollDecoder {
+
+public:
+
+    using DecodedFunc = std::function<void(PollBatch &)>;
+
+private:
+
+    // Only one poll is outstanding at once, so this is plenty
+    static const size_t QUEUE_SIZE = 4;
+
+    DecodedFunc decoded;
+
+    SpscQueue<std::unique_ptr<PollBatch>, QUEUE_SIZE> to_worker;
+    SpscQueue<std::unique_ptr<PollBatch>, QUEUE_SIZE> from_worker;
+
+    // Only for the worker to sleep on while there's nothing to decode
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    std::thread worker;
+
+    // The worker writes to notify_write to wake up the main loop, which watches notify_read. Both
+    // are the same eventfd on Linux.
+    int notify_read;
+    int notify_write;
+    guint input_handle;
+
+    bool open_notify();
+    void close_notify();
+
+    void run();
+    void decoded_cb(gint fd, PurpleInputCondition cond);
+
+public:
+
+    PollDecoder(DecodedFunc decoded);
+    ~PollDecoder();
+
+    // Returns false if the worker couldn't be started, in which case decoding should be done on
+    // the main loop.
+    bool start();
+    void stop();
+
+    bool running() const { return worker.joinable(); }
+
+    // Takes the batch if it could be queued. Its callback runs later on the main loop.
+    bool submit(std::unique_ptr<PollBatch> &batch);
+
+    // What the worker does with each batch. Doesn't touch libpurple, so it's safe on any thread.
+    static void decode(PollBatch &batch);
+
+};
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <time.h>
 
 #include <debug.h>
@@ -5,23 +7,49 @@
 #include "constants.hpp"
 #include "poller.hpp"
 #include "purpleline.hpp"
+#include "whenall.hpp"
+#include "wrapper.hpp"
 
 Poller::Poller(PurpleLine &parent)
-    : parent(parent)
+    : parent(parent),
+    retry_handle(0),
+    poll_sent(0),
+    stats_(),
+    decoder([this](PollBatch &batch) { batch_decoded(batch); }),
+    delivery_latency_((gint64)LINE_DELIVERY_WINDOW * G_USEC_PER_SEC),
+    write_time_((gint64)LINE_DELIVERY_WINDOW * G_USEC_PER_SEC),
+    delivery_slow(false),
+    latency_since(0),
+    poll_interrupted(true)
 {
     client = std::make_shared<ThriftClient>(parent.acct, parent.conn, LINE_POLL_PATH);
     client->set_auto_reconnect(true);
+    client->set_timeout(LINE_POLL_TIMEOUT);
+    client->set_idle_timeout(LINE_POLL_IDLE_TIMEOUT);
+    client->set_tracer(&parent.tracer);
 }
 
 Poller::~Poller() {
+    if (retry_handle)
+        purple_timeout_remove(retry_handle);
+
+    decoder.stop();
     client.reset();
 }
 
 void Poller::start() {
+    if (purple_account_get_bool(parent.acct, LINE_ACCOUNT_DECODE_THREAD, FALSE))
+        decoder.start();
+
     fetch_operations();
 }
 
 void Poller::fetch_operations() {
+    poll_sent = g_get_monotonic_time();
+    stats_.polls++;
+
+    // If the connection dies while waiting, the same request is sent again on a new one, so
+    // polling resumes from local_rev.
     client->send_fetchOperations(local_rev, 50);
     client->send([this]() {
         int status = client->status_code();
@@ -30,171 +58,439 @@ void Poller::fetch_operations() {
             // Plugin closing
             return;
         } else if (status == 410) {
-            // Long poll timeout, resend
+            // Long poll timeout, resend. Anything much longer than this without data means the
+            // connection is dead.
+
+            stats_.long_poll_timeouts++;
+            stats_.last_success = g_get_monotonic_time();
+
+            int interval = (int)((g_get_monotonic_time() - poll_sent) / G_USEC_PER_SEC);
+            client->set_idle_timeout(std::max(interval + interval / 2, LINE_POLL_IDLE_MIN));
+
             fetch_operations();
             return;
         } else if (status != 200) {
-            purple_debug_warning("line", "fetchOperations error %d. TODO: Retry after a timeout.\n",
-                status);
+            guint delay = client->supervisor().failure();
+
+            stats_.errors++;
+            poll_interrupted = true;
+
+            purple_debug_warning("line", "fetchOperations error %d, retrying in %ums.\n",
+                status, delay);
+
+            retry_handle = purple_timeout_add(delay, WRAPPER(Poller::retry_timeout_cb),
+                (gpointer)this);
             return;
         }
 
-        std::vector<line::Operation> operations;
-        client->recv_fetchOperations(operations);
+        client->supervisor().success();
 
-        for (line::Operation &op: operations) {
-            switch (op.type) {
-                case line::OpType::END_OF_OPERATION: // 0
-                    break;
-
-                case line::OpType::ADD_CONTACT: // 4
-                    parent.blist_update_buddy(op.param1);
-                    break;
-
-                case line::OpType::BLOCK_CONTACT: // 6
-                    parent.blist_remove_buddy(op.param1);
-                    break;
-
-                case line::OpType::UNBLOCK_CONTACT: // 7
-                    parent.blist_update_buddy(op.param1);
-                    break;
-
-                case line::OpType::CREATE_GROUP: // 9
-                case line::OpType::UPDATE_GROUP: // 10
-                case line::OpType::NOTIFIED_UPDATE_GROUP: // 11
-                case line::OpType::INVITE_INTO_GROUP: // 12
-                    parent.blist_update_chat(op.param1, ChatType::GROUP);
-                    break;
-
-                case line::OpType::NOTIFIED_INVITE_INTO_GROUP: // 13
-                    op_notified_invite_into_group(op);
-                    break;
-
-                case line::OpType::LEAVE_GROUP: // 14
-                    parent.blist_remove_chat(op.param1, ChatType::GROUP);
-                    break;
-
-                case line::OpType::NOTIFIED_LEAVE_GROUP: // 15
-                    parent.blist_update_chat(op.param1, ChatType::GROUP);
-                    break;
-
-                case line::OpType::ACCEPT_GROUP_INVITATION: // 16
-                    parent.blist_update_chat(op.param1, ChatType::GROUP);
-                    break;
-
-                case line::OpType::NOTIFIED_ACCEPT_GROUP_INVITATION: // 17
-                case line::OpType::KICKOUT_FROM_GROUP: // 18
-                    parent.blist_update_chat(op.param1, ChatType::GROUP);
-                    break;
-
-                case line::OpType::NOTIFIED_KICKOUT_FROM_GROUP: // 19
-                    op_notified_kickout_from_group(op);
-                    break;
-
-                case line::OpType::CREATE_ROOM: // 20
-                case line::OpType::INVITE_INTO_ROOM: // 21
-                    parent.blist_update_chat(op.param1, ChatType::ROOM);
-                    break;
-
-                case line::OpType::NOTIFIED_INVITE_INTO_ROOM: // 22
-                    // TODO: Perhaps show who invited the user (param2)
-                    parent.blist_update_chat(op.param1, ChatType::ROOM);
-                    break;
-
-                case line::OpType::LEAVE_ROOM: // 23
-                    parent.blist_remove_chat(op.param1, ChatType::ROOM);
-                    break;
-
-                case line::OpType::NOTIFIED_LEAVE_ROOM: // 24
-                    parent.blist_update_chat(op.param1, ChatType::ROOM);
-                    break;
-
-                case line::OpType::SEND_MESSAGE: // 25
-                case line::OpType::RECEIVE_MESSAGE: // 26
-                    parent.write_message(op.message, false);
-                    break;
-
-                case line::OpType::CANCEL_INVITATION_GROUP: // 31
-                case line::OpType::NOTIFIED_CANCEL_INVITATION_GROUP: // 32
-                    parent.blist_update_chat(op.param1, ChatType::GROUP);
-                    break;
-
-                case line::OpType::DUMMY: // 48;
-                    break;
-
-                case line::OpType::UPDATE_CONTACT: // 49
-                    parent.blist_update_buddy(op.param1);
-                    break;
-
-                default:
-                    purple_debug_warning("line", "Unhandled operation type: %d\n", op.type);
-                    break;
+        // The first batch after logging in or after a failed poll is backlog rather than newly
+        // sent messages. A poll that was just resent on a new connection didn't miss anything.
+        if (poll_interrupted) {
+            latency_since = g_get_real_time();
+            poll_interrupted = false;
+        }
+
+        if (decoder.running()) {
+            // Decoded on the worker thread, and handled once it's done
+            std::unique_ptr<PollBatch> batch(new PollBatch());
+            client->recv_fetchOperations_reply(batch->reply);
+
+            if (!decoder.submit(batch)) {
+                PollDecoder::decode(*batch);
+                batch_decoded(*batch);
             }
 
-            if (op.revision > local_rev)
-                local_rev = op.revision;
+            return;
         }
 
-        fetch_operations();
+        // The operations point into the response body, so anything that's kept has to be copied.
+        OperationList operations;
+        client->recv_fetchOperations(operations);
+
+        handle_operations(operations);
     });
 }
 
-void Poller::op_notified_kickout_from_group(line::Operation &op) {
+void Poller::batch_decoded(PollBatch &batch) {
+    if (!batch.error.empty()) {
+        std::string msg = "LINE: Transport error: ";
+        msg += batch.error;
+
+        purple_connection_error(parent.conn, msg.c_str());
+        return;
+    }
+
+    handle_operations(batch.operations);
+}
+
+// The operations point into a response body, so anything that's kept has to be copied.
+void Poller::handle_operations(OperationList &operations) {
+    stats_.operations += operations.size();
+    stats_.last_success = g_get_monotonic_time();
+
+    gint64 batch_start = stats_.last_success;
+
+    for (size_t i = 0; i < operations.size(); i++) {
+        const OperationView &op = operations[i];
+
+        // Refreshes made redundant by a later one in the same batch are skipped
+        if (refreshed_again(operations, i))
+            stats_.skipped++;
+        else
+            handle_operation(op);
+
+        if (op.revision > local_rev)
+            local_rev = op.revision;
+    }
+
+    parent.tracer.span(Tracer::Track::MAIN, "operations", batch_start, g_get_monotonic_time(),
+        { { "count", (int64_t)operations.size() } });
+
+    check_delivery_latency();
+
+    fetch_operations();
+}
+
+void Poller::handle_operation(const OperationView &op) {
+    invalidate_entities(op);
+
+    switch (op.type) {
+        case line::OpType::END_OF_OPERATION: // 0
+            break;
+
+        case line::OpType::ADD_CONTACT: // 4
+            parent.blist_update_buddy(op.param1.str());
+            break;
+
+        case line::OpType::BLOCK_CONTACT: // 6
+            parent.blist_remove_buddy(op.param1.str());
+            break;
+
+        case line::OpType::UNBLOCK_CONTACT: // 7
+            parent.blist_update_buddy(op.param1.str());
+            break;
+
+        case line::OpType::CREATE_GROUP: // 9
+        case line::OpType::UPDATE_GROUP: // 10
+        case line::OpType::NOTIFIED_UPDATE_GROUP: // 11
+        case line::OpType::INVITE_INTO_GROUP: // 12
+            parent.blist_update_chat(op.param1.str(), ChatType::GROUP);
+            break;
+
+        case line::OpType::NOTIFIED_INVITE_INTO_GROUP: // 13
+            op_notified_invite_into_group(op);
+            break;
+
+        case line::OpType::LEAVE_GROUP: // 14
+            parent.blist_remove_chat(op.param1.str(), ChatType::GROUP);
+            break;
+
+        case line::OpType::NOTIFIED_LEAVE_GROUP: // 15
+            parent.apply_member_change(op.param1.str(), MemberChange::LEFT,
+                op.param2.str());
+            break;
+
+        case line::OpType::ACCEPT_GROUP_INVITATION: // 16
+            parent.blist_update_chat(op.param1.str(), ChatType::GROUP);
+            break;
+
+        case line::OpType::NOTIFIED_ACCEPT_GROUP_INVITATION: // 17
+            parent.apply_member_change(op.param1.str(), MemberChange::JOINED,
+                op.param2.str());
+            break;
+
+        case line::OpType::KICKOUT_FROM_GROUP: // 18
+            parent.apply_member_change(op.param1.str(), MemberChange::LEFT,
+                op.param2.str());
+            break;
+
+        case line::OpType::NOTIFIED_KICKOUT_FROM_GROUP: // 19
+            op_notified_kickout_from_group(op);
+            break;
+
+        case line::OpType::CREATE_ROOM: // 20
+        case line::OpType::INVITE_INTO_ROOM: // 21
+            parent.blist_update_chat(op.param1.str(), ChatType::ROOM);
+            break;
+
+        case line::OpType::NOTIFIED_INVITE_INTO_ROOM: // 22
+            // TODO: Perhaps show who invited the user (param2)
+            parent.blist_update_chat(op.param1.str(), ChatType::ROOM);
+            break;
+
+        case line::OpType::LEAVE_ROOM: // 23
+            parent.blist_remove_chat(op.param1.str(), ChatType::ROOM);
+            break;
+
+        case line::OpType::NOTIFIED_LEAVE_ROOM: // 24
+            parent.blist_update_chat(op.param1.str(), ChatType::ROOM);
+            break;
+
+        case line::OpType::SEND_MESSAGE: // 25
+            {
+                line::Message msg;
+                op.message().to_message(msg);
+                parent.write_message(std::move(msg), false);
+            }
+            break;
+
+        case line::OpType::RECEIVE_MESSAGE: // 26
+            write_received_message(op);
+            break;
+
+        case line::OpType::CANCEL_INVITATION_GROUP: // 31
+            parent.apply_member_change(op.param1.str(), MemberChange::UNINVITED,
+                op.param2.str());
+            break;
+
+        case line::OpType::NOTIFIED_CANCEL_INVITATION_GROUP: // 32
+            parent.apply_member_change(op.param1.str(), MemberChange::UNINVITED,
+                op.param3.str());
+            break;
+
+        case line::OpType::DUMMY: // 48;
+            break;
+
+        case line::OpType::UPDATE_CONTACT: // 49
+            parent.blist_update_buddy(op.param1.str());
+            break;
+
+        default:
+            purple_debug_warning("line", "Unhandled operation type: %d\n", op.type);
+            break;
+    }
+}
+
+// The kind of entity that an operation only fetches again and updates, if that's all it does, or
+// 0. The entity's id is param1.
+static char refresh_kind(const OperationView &op) {
+    switch (op.type) {
+        case line::OpType::ADD_CONTACT:
+        case line::OpType::UNBLOCK_CONTACT:
+        case line::OpType::UPDATE_CONTACT:
+            return 'c';
+
+        case line::OpType::CREATE_GROUP:
+        case line::OpType::UPDATE_GROUP:
+        case line::OpType::NOTIFIED_UPDATE_GROUP:
+        case line::OpType::INVITE_INTO_GROUP:
+        case line::OpType::ACCEPT_GROUP_INVITATION:
+            return 'g';
+
+        case line::OpType::CREATE_ROOM:
+        case line::OpType::INVITE_INTO_ROOM:
+        case line::OpType::NOTIFIED_INVITE_INTO_ROOM:
+        case line::OpType::NOTIFIED_LEAVE_ROOM:
+            return 'r';
+
+        default:
+            return 0;
+    }
+}
+
+// A refresh is redundant if the same entity is refreshed again later in the batch, as the later one
+// fetches whatever the earlier one would have anyway. Other operations, including messages, are
+// never skipped or reordered. Batches are at most 50 operations, so the rest of the batch is just
+// scanned.
+bool Poller::refreshed_again(const OperationList &operations, size_t i) {
+    char kind = refresh_kind(operations[i]);
+    if (!kind)
+        return false;
+
+    for (size_t j = i + 1; j < operations.size(); j++) {
+        if (refresh_kind(operations[j]) == kind && operations[j].param1 == operations[i].param1)
+            return true;
+    }
+
+    return false;
+}
+
+// Whatever an operation is about has changed, so it's fetched again the next time it's needed.
+// Membership changes that are applied to the known group as they are don't count.
+void Poller::invalidate_entities(const OperationView &op) {
+    switch (op.type) {
+        case line::OpType::ADD_CONTACT:
+        case line::OpType::BLOCK_CONTACT:
+        case line::OpType::UNBLOCK_CONTACT:
+        case line::OpType::UPDATE_CONTACT:
+            parent.contact_cache.invalidate(op.param1.str());
+            break;
+
+        case line::OpType::CREATE_GROUP:
+        case line::OpType::UPDATE_GROUP:
+        case line::OpType::NOTIFIED_UPDATE_GROUP:
+        case line::OpType::INVITE_INTO_GROUP:
+        case line::OpType::LEAVE_GROUP:
+        case line::OpType::ACCEPT_GROUP_INVITATION:
+            parent.group_cache.invalidate(op.param1.str());
+            break;
+
+        case line::OpType::CREATE_ROOM:
+        case line::OpType::INVITE_INTO_ROOM:
+        case line::OpType::NOTIFIED_INVITE_INTO_ROOM:
+        case line::OpType::LEAVE_ROOM:
+        case line::OpType::NOTIFIED_LEAVE_ROOM:
+            parent.room_cache.invalidate(op.param1.str());
+            break;
+
+        default:
+            break;
+    }
+}
+
+int Poller::retry_timeout_cb() {
+    retry_handle = 0;
+
+    client->supervisor().retrying();
+
+    fetch_operations();
+
+    return FALSE;
+}
+
+void Poller::write_received_message(const OperationView &op) {
+    gint64 start = g_get_monotonic_time();
+
+    const MessageView &view = op.message();
+
+    line::Message msg;
+    view.to_message(msg);
+
+    // Messages queued while the conversation's history is fetched are counted when they're
+    // played back
+    if (!parent.write_message(std::move(msg), false))
+        return;
+
+    gint64 end = g_get_monotonic_time();
+
+    write_time_.add(end, end - start);
+
+    message_delivered(view.createdTime ? view.createdTime : op.createdTime);
+}
+
+void Poller::message_delivered(int64_t created) {
+    // Server times are in milliseconds since the epoch
+    if (created > 0 && created * 1000 >= latency_since) {
+        gint64 latency = g_get_real_time() - created * 1000;
+        delivery_latency_.add(g_get_monotonic_time(), std::max(latency, (gint64)0));
+    }
+}
+
+// Logs when the recent p99 delivery latency goes over the configured limit and when it's back
+// under it
+void Poller::check_delivery_latency() {
+    int limit_ms = purple_account_get_int(parent.acct, LINE_ACCOUNT_DELIVERY_WARNING,
+        LINE_DELIVERY_WARNING_DEFAULT);
+
+    if (limit_ms <= 0)
+        return;
+
+    Histogram latency = delivery_latency();
+    if (latency.count() == 0)
+        return;
+
+    gint64 p99_ms = latency.percentile(99) / 1000;
+    bool slow = (p99_ms > limit_ms);
+
+    if (slow && !delivery_slow) {
+        purple_debug_warning("line", "Message delivery is slow: p99 < %" G_GINT64_FORMAT
+            "ms over %d messages, limit %dms (write_message %s)\n",
+            p99_ms, (int)latency.count(), limit_ms, write_time().summary().c_str());
+    } else if (!slow && delivery_slow) {
+        purple_debug_info("line", "Message delivery is back under %dms.\n", limit_ms);
+    }
+
+    delivery_slow = slow;
+}
+
+void Poller::op_notified_kickout_from_group(const OperationView &op) {
+    std::string group_id = op.param1.str(), kicker = op.param2.str(), mids = op.param3.str();
     std::string msg;
 
-    if (op.param3 == parent.profile.mid) {
+    // More than one member can be removed at once, separated by \x1e
+    std::vector<std::string> kicked;
+
+    size_t start = 0;
+    while (start <= mids.size()) {
+        size_t end = mids.find('\x1e', start);
+        if (end == std::string::npos)
+            end = mids.size();
+
+        if (end > start)
+            kicked.push_back(mids.substr(start, end - start));
+
+        start = end + 1;
+    }
+
+    if (std::find(kicked.begin(), kicked.end(), parent.profile.mid) != kicked.end()) {
         msg = "You were removed from the group by ";
-        parent.blist_remove_chat(op.param1, ChatType::GROUP);
+        kicked.assign(1, parent.profile.mid);
+        parent.blist_remove_chat(group_id, ChatType::GROUP);
     } else {
         msg = "Removed from the group by ";
-        parent.blist_update_chat(op.param1, ChatType::GROUP);
+        parent.apply_member_change(group_id, MemberChange::LEFT, mids);
     }
 
-    if (parent.contacts.count(op.param2) == 1)
-        msg += parent.contacts[op.param2].displayName;
+    if (parent.contacts.count(kicker) == 1)
+        msg += parent.contacts[kicker].displayName;
     else
         msg += "(unknown contact)";
 
     PurpleConversation *conv = purple_find_conversation_with_account(
         PURPLE_CONV_TYPE_CHAT,
-        op.param1.c_str(),
+        group_id.c_str(),
         parent.acct);
 
     if (conv) {
-        purple_conversation_write(
-            conv,
-            op.param3.c_str(),
-            msg.c_str(),
-            PURPLE_MESSAGE_SYSTEM,
-            time(NULL));
+        for (const std::string &mid: kicked) {
+            purple_conversation_write(
+                conv,
+                mid.c_str(),
+                msg.c_str(),
+                PURPLE_MESSAGE_SYSTEM,
+                time(NULL));
+        }
     }
 }
 
-void Poller::op_notified_invite_into_group(line::Operation &op) {
-    // TODO: Maybe use cached objects instead of re-requesting every time
-
-    parent.c_out->send_getGroup(op.param1);
-    parent.c_out->send([this, op]{
+void Poller::op_notified_invite_into_group(const OperationView &op) {
+    // Filled in by the lookups below, and shared by their callbacks instead of being copied into
+    // each one
+    struct Invite {
+        std::string group_id;
         line::Group group;
-        parent.c_out->recv_getGroup(group);
+        line::Contact inviter;
+        line::Contact invitee;
+    };
 
-        if (!group.__isset.id) {
-            purple_debug_warning("line", "Invited into unknown group: %s\n", op.param1.c_str());
-            return;
-        }
+    auto invite = std::make_shared<Invite>();
+    invite->group_id = op.param1.str();
 
-        parent.c_out->send_getContact(op.param2);
-        parent.c_out->send([this, group, op]() mutable {
-            line::Contact inviter;
-            parent.c_out->recv_getContact(inviter);
+    // The lookups don't depend on each other, so they're made together and end up in the same
+    // batches.
+    WhenAll all;
 
-            parent.c_out->send_getContact(op.param3);
-            parent.c_out->send([this, group, inviter, op]() mutable {
-                line::Contact invitee;
-                parent.c_out->recv_getContact(invitee);
+    parent.group_cache.get(invite->group_id, all.add([invite](line::Group &group) {
+        invite->group = std::move(group);
+    }));
+
+    parent.contact_cache.get(op.param2.str(), all.add([invite](line::Contact &inviter) {
+        invite->inviter = std::move(inviter);
+    }));
+
+    parent.contact_cache.get(op.param3.str(), all.add([invite](line::Contact &invitee) {
+        invite->invitee = std::move(invitee);
+    }));
+
+    all.then([this, invite]() {
+        if (!invite->group.__isset.id) {
+            purple_debug_warning("line", "Invited into unknown group: %s\n",
+                invite->group_id.c_str());
+            return;
+        }
 
-                parent.handle_group_invite(group, invitee, inviter);
-            });
-        });
+        parent.handle_group_invite(invite->group, invite->invitee, invite->inviter);
     });
 }
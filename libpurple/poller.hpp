@@ -2,15 +2,30 @@
 
 #include <string>
 #include <deque>
+#include <vector>
 
 #include <debug.h>
 #include <plugin.h>
 #include <prpl.h>
 
+#include "polldecoder.hpp"
 #include "thriftclient.hpp"
 
 class PurpleLine;
 
+struct PollStats {
+    uint64_t polls;
+    uint64_t long_poll_timeouts;
+    uint64_t errors;
+    uint64_t operations;
+
+    // Refreshes skipped because a later operation in the same batch refreshes the same thing
+    uint64_t skipped;
+
+    // Monotonic time of the last successful poll
+    gint64 last_success;
+};
+
 class Poller {
 
     PurpleLine &parent;
@@ -18,20 +33,62 @@ class Poller {
     std::shared_ptr<ThriftClient> client;
     int64_t local_rev;
 
+    guint retry_handle;
+
+    // When the current poll was sent
+    gint64 poll_sent;
+
+    PollStats stats_;
+
+    // Only running if enabled for the account
+    PollDecoder decoder;
+
+    // From the server creating a received message to it being shown, and the time showing it took
+    RollingHistogram delivery_latency_;
+    RollingHistogram write_time_;
+    bool delivery_slow;
+
+    // Messages created before this real time in microseconds had piled up while polling was
+    // failing or before logging in, so they don't count as delivered late.
+    gint64 latency_since;
+
+    // Whether the next batch is the first one after logging in or after polling failed
+    bool poll_interrupted;
+
 public:
 
     Poller(PurpleLine &parent);
     ~Poller();
 
     void start();
+    const ThriftClient &thrift_client() const { return *client; }
+    const PollStats &stats() const { return stats_; }
+    Histogram delivery_latency() { return delivery_latency_.snapshot(g_get_monotonic_time()); }
+    Histogram write_time() { return write_time_.snapshot(g_get_monotonic_time()); }
+    int64_t get_local_rev() const { return local_rev; }
     void set_local_rev(int64_t local_rev) { this->local_rev = local_rev; }
 
+    // Records the delivery latency of a received message created at server time created, once
+    // it's been written to its conversation
+    void message_delivered(int64_t created);
+
 private:
 
     // Long poll return channel
     void fetch_operations();
+    int retry_timeout_cb();
+
+    void batch_decoded(PollBatch &batch);
+    void handle_operations(OperationList &operations);
+
+    static bool refreshed_again(const OperationList &operations, size_t i);
+    void handle_operation(const OperationView &op);
+    void invalidate_entities(const OperationView &op);
+
+    void write_received_message(const OperationView &op);
+    void check_delivery_latency();
 
-    void op_notified_kickout_from_group(line::Operation &op);
-    void op_notified_invite_into_group(line::Operation &op);
+    void op_notified_kickout_from_group(const OperationView &op);
+    void op_notified_invite_into_group(const OperationView &op);
 
 };
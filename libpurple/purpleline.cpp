@@ -40,23 +40,193 @@ std::string url_encode(std::string const &str) {
     return purple_url_encode(str.c_str());
 }
 
+std::set<PurpleLine *> PurpleLine::instances;
+
 PurpleLine::PurpleLine(PurpleConnection *conn, PurpleAccount *acct) :
     conn(conn),
     acct(acct),
+    c_out(std::make_shared<ThriftClient>(acct, conn, LINE_COMMAND_PATH, LINE_COMMAND_LANES)),
+    lookups(c_out),
     http(acct),
     os_http(acct, conn, LINE_OS_SERVER, 443, false),
     poller(*this),
     pin_verifier(*this),
-    next_purple_id(1)
+    next_purple_id(1),
+    contact_cache(contacts,
+        [this](const std::string &mid, RequestPriority priority,
+            EntityCache<line::Contact>::EntityCallback callback)
+        {
+            lookups.get_contact(mid, std::move(callback), priority);
+        }),
+    group_cache(groups,
+        [this](const std::string &id, RequestPriority priority,
+            EntityCache<line::Group>::EntityCallback callback)
+        {
+            lookups.get_group(id, std::move(callback), priority);
+        }),
+    room_cache(rooms,
+        [this](const std::string &id, RequestPriority priority,
+            EntityCache<line::Room>::EntityCallback callback)
+        {
+            // There is no batched call for rooms. Shared because the callback can only be moved.
+            auto done = std::make_shared<EntityCache<line::Room>::EntityCallback>(
+                std::move(callback));
+
+            c_out->send_getRoom(id);
+            c_out->send(priority, [this, done]() {
+                line::Room room;
+
+                try {
+                    c_out->recv_getRoom(room);
+                } catch (line::TalkException &err) {
+                    purple_debug_warning("line", "Couldn't get room: %s\n", err.reason.c_str());
+                }
+
+                (*done)(room);
+            });
+        }),
+    snapshot_rev(-1),
+    snapshot_time(0),
+    snapshot_stale(false),
+    snapshot_save_timeout(0),
+    synced_rev(-1)
 {
-    c_out = std::make_shared<ThriftClient>(acct, conn, LINE_COMMAND_PATH);
+    c_out->set_pipeline_depth(LINE_PIPELINE_DEPTH);
+    c_out->set_tracer(&tracer);
     os_http.set_auto_reconnect(true);
+
+    const char *trace_file = purple_account_get_string(acct, LINE_ACCOUNT_TRACE_FILE, "");
+    if (trace_file && *trace_file)
+        tracer.open(trace_file);
+
+    instances.insert(this);
 }
 
 PurpleLine::~PurpleLine() {
+    instances.erase(this);
+
+    if (snapshot_save_timeout)
+        purple_timeout_remove(snapshot_save_timeout);
+
     c_out->close();
 }
 
+static void collect_transport_metrics(MetricsWriter &writer, MetricsWriter::Labels labels,
+    const TransportStats &stats)
+{
+    writer.counter("line_requests_total", "Requests made.", labels, stats.requests);
+    writer.counter("line_responses_total", "Responses received.", labels, stats.responses);
+    writer.counter("line_bytes_in_total", "Bytes received.", labels, stats.bytes_in);
+    writer.counter("line_bytes_out_total", "Bytes sent.", labels, stats.bytes_out);
+    writer.counter("line_connects_total", "Connections made.", labels, stats.connects);
+    writer.counter("line_reconnects_total", "Reconnections after failures.", labels,
+        stats.reconnects);
+    writer.counter("line_timeouts_total", "Requests that timed out.", labels, stats.timeouts);
+    writer.gauge("line_queue_high_water", "Most requests queued at once.", labels,
+        stats.queue_high_water);
+    writer.histogram("line_queue_seconds", "Time requests waited to be sent.", labels,
+        stats.queue_time);
+    writer.histogram("line_wire_seconds", "Time from sending a request to its response.", labels,
+        stats.wire_time);
+}
+
+static void collect_client_metrics(MetricsWriter &writer, MetricsWriter::Labels labels,
+    const ThriftClient &client)
+{
+    collect_transport_metrics(writer, labels, client.transport_stats());
+
+    writer.gauge("line_queue_size", "Requests queued or on the wire.", labels,
+        client.queue_size());
+    writer.counter("line_compressed_bytes_total", "Response body bytes received compressed.",
+        labels, client.compressed_bytes());
+    writer.counter("line_uncompressed_bytes_total",
+        "Size of compressed response bodies after decompressing.",
+        labels, client.uncompressed_bytes());
+
+    const RetrySupervisor &supervisor = client.supervisor();
+
+    writer.counter("line_retry_failures_total", "Failures reported to the retry supervisor.",
+        labels, supervisor.counters().failures);
+    writer.counter("line_circuit_opened_total", "Times the retry circuit opened.",
+        labels, supervisor.counters().opened);
+    writer.gauge("line_circuit_open", "Whether the retry circuit is open (1) or half-open (2).",
+        labels, (int)supervisor.state());
+
+    for (auto &i: client.call_stats()) {
+        MetricsWriter::Labels call_labels = labels;
+        call_labels.push_back({ "method", i.first });
+
+        writer.counter("line_calls_total", "Calls by method.", call_labels, i.second.calls);
+        writer.histogram("line_call_wire_seconds", "Time from sending a call to its response.",
+            call_labels, i.second.wire_time);
+        writer.histogram("line_call_queue_seconds", "Time calls waited to be sent.",
+            call_labels, i.second.queue_time);
+    }
+}
+
+void PurpleLine::collect_metrics(MetricsWriter &writer) {
+    MetricsWriter::Labels labels = { { "account", purple_account_get_username(acct) } };
+
+    writer.gauge("line_contacts", "Known contacts.", labels, contacts.size());
+    writer.gauge("line_groups", "Known groups.", labels, groups.size());
+    writer.gauge("line_rooms", "Known rooms.", labels, rooms.size());
+
+    const PollStats &poll = poller.stats();
+
+    writer.counter("line_polls_total", "Long polls sent.", labels, poll.polls);
+    writer.counter("line_poll_timeouts_total", "Long polls that ended without operations.",
+        labels, poll.long_poll_timeouts);
+    writer.counter("line_poll_errors_total", "Long polls that failed.", labels, poll.errors);
+    writer.counter("line_operations_total", "Operations received.", labels, poll.operations);
+    writer.counter("line_operations_skipped_total",
+        "Refreshes skipped because a later operation in the same batch refreshes the same thing.",
+        labels, poll.skipped);
+    writer.gauge("line_poll_last_success_age_seconds", "Seconds since the last successful poll.",
+        labels, poll.last_success
+            ? (double)(g_get_monotonic_time() - poll.last_success) / G_USEC_PER_SEC
+            : -1.0);
+
+    writer.histogram("line_delivery_seconds",
+        "Time from the server creating a received message to showing it, recent messages only.",
+        labels, poller.delivery_latency());
+    writer.histogram("line_write_message_seconds",
+        "Time spent showing received messages, recent messages only.",
+        labels, poller.write_time());
+
+    auto channel = [&labels](const char *name) {
+        MetricsWriter::Labels l = labels;
+        l.push_back({ "channel", name });
+        return l;
+    };
+
+    auto collect_cache = [&writer, &labels](const char *entity, const EntityCacheStats &stats) {
+        MetricsWriter::Labels l = labels;
+        l.push_back({ "entity", entity });
+
+        writer.counter("line_cache_hits_total", "Lookups served from memory.", l, stats.hits);
+        writer.counter("line_cache_misses_total", "Lookups that had to be fetched.", l,
+            stats.misses);
+        writer.counter("line_cache_shared_total",
+            "Lookups that waited for a fetch already on its way.", l, stats.shared);
+    };
+
+    collect_cache("contact", contact_cache.stats());
+    collect_cache("group", group_cache.stats());
+    collect_cache("room", room_cache.stats());
+
+    const LookupStats &lookup = lookups.stats();
+
+    writer.counter("line_lookups_total", "Contacts and groups looked up by id.", labels,
+        lookup.lookups);
+    writer.counter("line_lookup_batches_total", "Batched calls made for lookups.", labels,
+        lookup.batches);
+
+    collect_client_metrics(writer, channel("command"), *c_out);
+    collect_client_metrics(writer, channel("poll"), poller.thrift_client());
+    collect_transport_metrics(writer, channel("upload"), os_http.stats());
+    collect_transport_metrics(writer, channel("download"), http.stats());
+}
+
 const char *PurpleLine::list_icon(PurpleAccount *, PurpleBuddy *) {
     return "line";
 }
@@ -337,8 +507,9 @@ void PurpleLine::send_message(
 {
     std::string to(msg.to);
 
+    // Keyed by recipient so that messages to the same chat arrive in the order they were sent
     c_out->send_sendMessage(0, msg);
-    c_out->send([this, to, callback]() {
+    c_out->send(RequestPriority::INTERACTIVE, to, [this, to, callback]() {
         line::Message msg_back;
 
         try {
@@ -408,11 +579,9 @@ void PurpleLine::upload_media(std::string message_id, std::string type, std::str
         << data
         << "\r\n--" << boundary << "--\r\n";
 
-    std::string content_type = std::string("multipart/form-data; boundary=") + boundary;
-
-    os_http.write_virt((const uint8_t *)body.str().c_str(), body.tellp());
-
-    os_http.request("POST", "/talk/m/upload.nhn", content_type, [this]() {
+    os_http.request(RequestPriority::NORMAL, "POST", "/talk/m/upload.nhn", "multipart/form-data",
+        "boundary=" + boundary, body.str(), false, [this]()
+    {
         if (os_http.status_code() != 201) {
             purple_debug_warning(
                 "line",
@@ -440,7 +609,7 @@ void PurpleLine::remove_buddy(PurpleBuddy *buddy, PurpleGroup *) {
         purple_buddy_get_name(buddy),
         line::ContactSetting::CONTACT_SETTING_DELETE,
         "true");
-    c_out->send([this]{
+    c_out->send(RequestPriority::INTERACTIVE, [this]{
         try {
             c_out->recv_updateContactSetting();
         } catch (line::TalkException &err) {
@@ -470,7 +639,7 @@ void PurpleLine::signal_blist_node_removed(PurpleBlistNode *node) {
 
     if (type == ChatType::ROOM) {
         c_out->send_leaveRoom(0, id);
-        c_out->send([this]{
+        c_out->send(RequestPriority::INTERACTIVE, [this]{
             try {
                 c_out->recv_leaveRoom();
             } catch (line::TalkException &err) {
@@ -479,7 +648,7 @@ void PurpleLine::signal_blist_node_removed(PurpleBlistNode *node) {
         });
     } else if (type == ChatType::GROUP) {
         c_out->send_leaveGroup(0, id);
-        c_out->send([this]{
+        c_out->send(RequestPriority::INTERACTIVE, [this]{
             try {
                 c_out->recv_leaveGroup();
             } catch (line::TalkException &err) {
@@ -521,7 +690,17 @@ void PurpleLine::fetch_conversation_history(PurpleConversation *conv, int count,
     else
         c_out->send_getRecentMessages(name, count);
 
-    c_out->send([this, requested, type, name, end_seq]() {
+    // History the user asked for can't wait. Incoming messages are held back until the history
+    // fetched automatically for a new conversation arrives, so that can't be left waiting behind
+    // background work either.
+    RequestPriority priority = RequestPriority::BACKGROUND;
+
+    if (requested)
+        priority = RequestPriority::INTERACTIVE;
+    else if (purple_conversation_get_data(conv, "line-message-queue"))
+        priority = RequestPriority::NORMAL;
+
+    RequestHandle handle = c_out->send(priority, [this, requested, type, name, end_seq]() {
         int64_t new_end_seq = end_seq;
 
         std::vector<line::Message> recent_msgs;
@@ -580,7 +759,7 @@ void PurpleLine::fetch_conversation_history(PurpleConversation *conv, int count,
                 time(NULL));
 
             for (auto msgi = recent_msgs.rbegin(); msgi != recent_msgs.rend(); msgi++)
-                write_message(*msgi, true);
+                write_message(std::move(*msgi), true);
 
             purple_conversation_write(
                 conv,
@@ -601,10 +780,15 @@ void PurpleLine::fetch_conversation_history(PurpleConversation *conv, int count,
             }
         }
 
-        // If there's a message queue, play it back now
+        // If there's a message queue, play it back now. Received messages only count as
+        // delivered once they're shown.
         if (queue) {
-            for (line::Message &msg: *queue)
-                write_message(msg, false);
+            for (line::Message &msg: *queue) {
+                int64_t created = (msg.from_ != profile.mid) ? msg.createdTime : 0;
+
+                if (write_message(std::move(msg), false))
+                    poller.message_delivered(created);
+            }
 
             delete queue;
         }
@@ -617,6 +801,22 @@ void PurpleLine::fetch_conversation_history(PurpleConversation *conv, int count,
 
         purple_debug_info("line", "History done: new_end_seq=%" G_GINT64_FORMAT "\n", new_end_seq);
     });
+
+    // Kept so that the fetch can be cancelled if the conversation is closed first
+    auto *requests = (std::vector<RequestHandle> *)
+        purple_conversation_get_data(conv, "line-history-requests");
+
+    if (!requests) {
+        requests = new std::vector<RequestHandle>();
+        purple_conversation_set_data(conv, "line-history-requests", requests);
+    }
+
+    requests->erase(
+        std::remove_if(requests->begin(), requests->end(),
+            [](RequestHandle &r) { return r.done(); }),
+        requests->end());
+
+    requests->push_back(handle);
 }
 
 void PurpleLine::signal_deleting_conversation(PurpleConversation *conv) {
@@ -642,6 +842,16 @@ void PurpleLine::signal_deleting_conversation(PurpleConversation *conv) {
         purple_conversation_set_data(conv, "line-attachments", nullptr);
         delete atts;
     }
+
+    auto requests = (std::vector<RequestHandle> *)
+        purple_conversation_get_data(conv, "line-history-requests");
+    if (requests) {
+        for (RequestHandle &r: *requests)
+            r.cancel();
+
+        purple_conversation_set_data(conv, "line-history-requests", nullptr);
+        delete requests;
+    }
 }
 
 void PurpleLine::notify_error(std::string msg) {
@@ -11,8 +11,12 @@
 #include "constants.hpp"
 #include "thriftclient.hpp"
 #include "httpclient.hpp"
+#include "entitycache.hpp"
+#include "lookupbatcher.hpp"
 #include "poller.hpp"
 #include "pinverifier.hpp"
+#include "snapshot.hpp"
+#include "metricsexporter.hpp"
 
 class ThriftClient;
 
@@ -42,6 +46,14 @@ enum class ChatType {
     GROUP_INVITE = 3,
 };
 
+// Group membership changes that operations carry enough information for to be applied without
+// fetching the group
+enum class MemberChange {
+    JOINED = 1, // An invitee accepted
+    LEFT = 2, // A member left or was removed
+    UNINVITED = 3, // An invitation was cancelled
+};
+
 std::string markup_escape(std::string const &text);
 
 std::string markup_unescape(std::string const &markup);
@@ -68,11 +80,16 @@ class PurpleLine {
 
     std::shared_ptr<ThriftClient> c_out;
 
+    // getContact and getGroup lookups go through this to be batched
+    LookupBatcher lookups;
+
     HTTPClient http;
 
     // Remove if libpurple HTTP ever gets support for binary request bodies
     LineHttpTransport os_http;
 
+    Tracer tracer;
+
     friend class Poller;
     Poller poller;
 
@@ -92,14 +109,44 @@ class PurpleLine {
     std::map<std::string, line::Room> rooms;
     std::map<std::string, line::Contact> contacts;
 
+    // Membership changes applied to each group since it was last fetched
+    std::map<std::string, int> group_deltas;
+
+    // Look entities up through these instead of with c_out or lookups
+    EntityCache<line::Contact> contact_cache;
+    EntityCache<line::Group> group_cache;
+    EntityCache<line::Room> room_cache;
+
+    // Revision of the snapshot loaded at login, or -1 if there wasn't one. Contacts and groups in
+    // it that changed since are collected before syncing, unless the snapshot is too old or there
+    // were too many changes to look through, in which case everything is fetched like without a
+    // snapshot.
+    int64_t snapshot_rev;
+    gint64 snapshot_time; // Seconds since the epoch when it was saved
+    bool snapshot_stale;
+    guint snapshot_save_timeout;
+    std::set<std::string> changed_contacts;
+    std::set<std::string> changed_groups;
+
+    // Revision the contacts and groups were synced at during login, or -1 if they weren't yet
+    int64_t synced_rev;
+
     void *pin_ui_handle;
     guint pin_timeout;
 
 public:
 
+    // All live instances, for the metrics exporter
+    static std::set<PurpleLine *> instances;
+
     PurpleLine(PurpleConnection *conn, PurpleAccount *acct);
     ~PurpleLine();
 
+    void collect_metrics(MetricsWriter &writer);
+
+    // Whether the login, including syncing contacts and groups, has finished
+    bool logged_in() const { return synced_rev >= 0; }
+
     static void register_commands();
     static const char *list_icon(PurpleAccount *, PurpleBuddy *buddy);
     static GList *status_types(PurpleAccount *);
@@ -120,6 +167,9 @@ public:
     PurpleCmdRet cmd_open(PurpleConversation *conv,
         const gchar *, gchar **args, gchar **error, void *);
 
+    PurpleCmdRet cmd_linestats(PurpleConversation *conv,
+        const gchar *, gchar **args, gchar **error, void *);
+
 private:
 
     void connect_signals();
@@ -131,7 +181,9 @@ private:
         line::ContentType::type type, std::string id);
     Attachment *conv_attachment_get(PurpleConversation *conv, std::string token);
 
-    void write_message(line::Message &msg, bool replay);
+    // Takes the message, which may be queued until history has been fetched. Returns true if it
+    // was written to the conversation right away.
+    bool write_message(line::Message &&msg, bool replay);
     void write_message(PurpleConversation *conv, std::string &from, std::string &text,
         time_t mtime, int flags);
     void write_e2ee_error(PurpleConversation *conv);
@@ -169,14 +221,24 @@ private:
     void set_auth_token(std::string auth_token);
     void get_last_op_revision();
     void get_profile();
+    void load_snapshot();
+    void catch_up_snapshot(int64_t rev, int seen);
     void get_contacts();
+    void update_contacts(const std::vector<std::string> &uids,
+        std::vector<line::Contact> &fetched);
     void get_groups();
+    void update_groups(const std::vector<std::string> &gids, std::vector<line::Group> &fetched);
     void get_rooms();
     void update_rooms(line::MessageBoxWrapUpList wrap_up_list);
     void get_group_invites();
 
     void login_done();
 
+    std::string snapshot_path();
+    void snapshot_changed();
+    int snapshot_save_cb();
+    void save_snapshot();
+
     // blist
 
 private:
@@ -192,7 +254,8 @@ private:
     PurpleGroup *blist_ensure_group(std::string group_name, bool temporary=false);
     PurpleBuddy *blist_ensure_buddy(std::string uid, bool temporary=false);
     void blist_update_buddy(std::string uid, bool temporary=false);
-    PurpleBuddy *blist_update_buddy(line::Contact &contact, bool temporary=false);
+    PurpleBuddy *blist_update_buddy(line::Contact &&contact, bool temporary=false);
+    PurpleBuddy *blist_update_buddy(const line::Contact &contact, bool temporary=false);
     bool blist_is_buddy_in_any_conversation(std::string uid, PurpleConvChat *ignore_chat);
     void blist_remove_buddy(std::string uid,
         bool temporary_only=false, PurpleConvChat *ignore_chat=nullptr);
@@ -201,8 +264,10 @@ private:
     PurpleChat *blist_find_chat(std::string id, ChatType type);
     PurpleChat *blist_ensure_chat(std::string id, ChatType type);
     void blist_update_chat(std::string id, ChatType type);
-    PurpleChat *blist_update_chat(line::Group &group);
-    PurpleChat *blist_update_chat(line::Room &room);
+    PurpleChat *blist_update_chat(line::Group &&group);
+    PurpleChat *blist_update_chat(const line::Group &group);
+    PurpleChat *blist_update_chat(line::Room &&room);
+    PurpleChat *blist_update_chat(const line::Room &room);
     void blist_remove_chat(std::string id, ChatType type);
 
     // chats
@@ -223,6 +288,11 @@ private:
 
     void join_chat_success(ChatType type, std::string id);
 
+    void refresh_group(std::string id);
+    void apply_member_change(std::string group_id, MemberChange change, std::string mids);
+    bool apply_member_change(line::Group &group, MemberChange change, const std::string &mid,
+        PurpleConvChat *chat);
+
     void handle_group_invite(line::Group &group, line::Contact &invitee, line::Contact &inviter);
 };
 
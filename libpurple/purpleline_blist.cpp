@@ -61,19 +61,22 @@ void PurpleLine::blist_update_buddy(std::string uid, bool temporary) {
     // Put buddy on list already so it shows up as loading
     blist_ensure_buddy(uid.c_str(), temporary);
 
-    c_out->send_getContact(uid);
-    c_out->send([this, temporary]{
-        line::Contact contact;
-        c_out->recv_getContact(contact);
-
+    contact_cache.get(uid, [this, temporary](line::Contact &contact) {
         if (contact.__isset.mid)
-            blist_update_buddy(contact, temporary);
+            blist_update_buddy(std::move(contact), temporary);
     });
 }
 
-// Updates buddy details such as alias, icon, status message
-PurpleBuddy *PurpleLine::blist_update_buddy(line::Contact &contact, bool temporary) {
-    contacts[contact.mid] = contact;
+PurpleBuddy *PurpleLine::blist_update_buddy(const line::Contact &contact, bool temporary) {
+    return blist_update_buddy(line::Contact(contact), temporary);
+}
+
+// Updates buddy details such as alias, icon, status message. The contact is moved into contacts.
+PurpleBuddy *PurpleLine::blist_update_buddy(line::Contact &&new_contact, bool temporary) {
+    line::Contact &contact = contacts[new_contact.mid];
+    contact = std::move(new_contact);
+    contact_cache.stored(contact.mid);
+    snapshot_changed();
 
     if (!temporary
         && (contact.status == line::ContactStatus::FRIEND_BLOCKED
@@ -261,28 +264,29 @@ void PurpleLine::blist_update_chat(std::string id, ChatType type) {
     blist_ensure_chat(id.c_str(), type);
 
     if (type == ChatType::GROUP) {
-        c_out->send_getGroup(id);
-        c_out->send([this]{
-            line::Group group;
-            c_out->recv_getGroup(group);
-
+        group_cache.get(id, [this](line::Group &group) {
             if (group.__isset.id)
-                blist_update_chat(group);
+                blist_update_chat(std::move(group));
         });
     } else if (type == ChatType::ROOM) {
-        c_out->send_getRoom(id);
-        c_out->send([this]{
-            line::Room room;
-            c_out->recv_getRoom(room);
-
+        room_cache.get(id, [this](line::Room &room) {
             if (room.__isset.mid)
-                blist_update_chat(room);
+                blist_update_chat(std::move(room));
         });
     }
 }
 
-PurpleChat *PurpleLine::blist_update_chat(line::Group &group) {
-    groups[group.id] = group;
+PurpleChat *PurpleLine::blist_update_chat(const line::Group &group) {
+    return blist_update_chat(line::Group(group));
+}
+
+// The group is moved into groups
+PurpleChat *PurpleLine::blist_update_chat(line::Group &&new_group) {
+    line::Group &group = groups[new_group.id];
+    group = std::move(new_group);
+    group_cache.stored(group.id);
+    group_deltas.erase(group.id);
+    snapshot_changed();
 
     PurpleChat *chat = blist_ensure_chat(group.id, ChatType::GROUP);
 
@@ -301,8 +305,15 @@ PurpleChat *PurpleLine::blist_update_chat(line::Group &group) {
     return chat;
 }
 
-PurpleChat *PurpleLine::blist_update_chat(line::Room &room) {
-    rooms[room.mid] = room;
+PurpleChat *PurpleLine::blist_update_chat(const line::Room &room) {
+    return blist_update_chat(line::Room(room));
+}
+
+// The room is moved into rooms
+PurpleChat *PurpleLine::blist_update_chat(line::Room &&new_room) {
+    line::Room &room = rooms[new_room.mid];
+    room = std::move(new_room);
+    room_cache.stored(room.mid);
 
     PurpleChat *chat = blist_ensure_chat(room.mid, ChatType::ROOM);
 
@@ -324,6 +335,10 @@ PurpleChat *PurpleLine::blist_update_chat(line::Room &room) {
 void PurpleLine::blist_remove_chat(std::string id, ChatType type) {
     PurpleChat *chat = blist_find_chat(id, type);
 
-    if (chat)
+    if (chat) {
         purple_blist_remove_chat(chat);
+
+        if (type == ChatType::GROUP)
+            snapshot_changed();
+    }
 }
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "purpleline.hpp"
 
 std::map<ChatType, std::string> PurpleLine::chat_type_to_string {
@@ -80,7 +82,19 @@ void PurpleLine::handle_group_invite(
             nullptr,
             components);
     } else {
-        // Another user was invited - if a chat is open, add the user
+        // Another user was invited - keep the known group up to date and if a chat is open, add
+        // the user
+
+        auto known = groups.find(group.id);
+        if (known != groups.end()) {
+            std::vector<line::Contact> &invited = known->second.invitee;
+
+            bool found = std::any_of(invited.begin(), invited.end(),
+                [&invitee](const line::Contact &c) { return c.mid == invitee.mid; });
+
+            if (!found)
+                invited.push_back(invitee);
+        }
 
         PurpleConversation *conv = purple_find_conversation_with_account(
             PURPLE_CONV_TYPE_CHAT,
@@ -100,6 +114,123 @@ void PurpleLine::handle_group_invite(
     }
 }
 
+// Fetches a group in full, ignoring what's known about it
+void PurpleLine::refresh_group(std::string id) {
+    group_cache.invalidate(id);
+    blist_update_chat(id, ChatType::GROUP);
+}
+
+// Applies a membership change from an operation to a known group instead of fetching all of it
+// again, which for a large group can be hundreds of kilobytes. mids may contain more than one id,
+// separated by \x1e. The group is fetched anyway if it's not known, if the change doesn't fit what
+// is known about it, and every LINE_GROUP_DELTA_REFRESH changes in case something was missed.
+void PurpleLine::apply_member_change(std::string group_id, MemberChange change, std::string mids)
+{
+    auto found = groups.find(group_id);
+
+    if (found == groups.end()
+        || mids.empty()
+        || ++group_deltas[group_id] >= LINE_GROUP_DELTA_REFRESH)
+    {
+        refresh_group(group_id);
+        return;
+    }
+
+    PurpleConversation *conv = purple_find_conversation_with_account(
+        PURPLE_CONV_TYPE_CHAT,
+        group_id.c_str(),
+        acct);
+
+    PurpleConvChat *chat = conv ? PURPLE_CONV_CHAT(conv) : nullptr;
+
+    size_t start = 0;
+    while (start <= mids.size()) {
+        size_t end = mids.find('\x1e', start);
+        if (end == std::string::npos)
+            end = mids.size();
+
+        std::string mid = mids.substr(start, end - start);
+
+        if (mid == profile.mid && change != MemberChange::JOINED) {
+            blist_remove_chat(group_id, ChatType::GROUP);
+            return;
+        }
+
+        if (!mid.empty() && !apply_member_change(found->second, change, mid, chat)) {
+            refresh_group(group_id);
+            return;
+        }
+
+        start = end + 1;
+    }
+
+    snapshot_changed();
+}
+
+bool PurpleLine::apply_member_change(line::Group &group, MemberChange change,
+    const std::string &mid, PurpleConvChat *chat)
+{
+    auto has_mid = [&mid](const line::Contact &c) { return c.mid == mid; };
+
+    auto member = std::find_if(group.members.begin(), group.members.end(), has_mid);
+    auto invited = std::find_if(group.invitee.begin(), group.invitee.end(), has_mid);
+
+    switch (change) {
+        case MemberChange::JOINED:
+            if (member == group.members.end()) {
+                if (invited != group.invitee.end()) {
+                    group.members.push_back(std::move(*invited));
+                    group.invitee.erase(invited);
+                } else if (contacts.count(mid)) {
+                    group.members.push_back(contacts[mid]);
+                } else {
+                    // Not enough known about the new member
+                    return false;
+                }
+
+                member = group.members.end() - 1;
+            }
+
+            // Make sure the new member's name shows up, like for an invitee
+            blist_update_buddy(*member, true);
+
+            if (chat) {
+                if (purple_conv_chat_find_user(chat, mid.c_str()))
+                    purple_conv_chat_user_set_flags(chat, mid.c_str(), PURPLE_CBFLAGS_NONE);
+                else
+                    purple_conv_chat_add_user(chat, mid.c_str(), nullptr, PURPLE_CBFLAGS_NONE,
+                        TRUE);
+            }
+            break;
+
+        case MemberChange::LEFT:
+            if (member != group.members.end())
+                group.members.erase(member);
+
+            if (invited != group.invitee.end())
+                group.invitee.erase(invited);
+
+            if (chat && purple_conv_chat_find_user(chat, mid.c_str()))
+                purple_conv_chat_remove_user(chat, mid.c_str(), nullptr);
+            break;
+
+        case MemberChange::UNINVITED:
+            if (invited == group.invitee.end())
+                break;
+
+            group.invitee.erase(invited);
+
+            if (chat && member == group.members.end()
+                && purple_conv_chat_find_user(chat, mid.c_str()))
+            {
+                purple_conv_chat_remove_user(chat, mid.c_str(), nullptr);
+            }
+            break;
+    }
+
+    return true;
+}
+
 void PurpleLine::set_chat_participants(PurpleConvChat *chat, line::Group &group) {
     purple_conv_chat_clear_users(chat);
 
@@ -192,7 +323,7 @@ void PurpleLine::join_chat(GHashTable *components) {
 
     if (type == ChatType::GROUP_INVITE) {
         c_out->send_acceptGroupInvitation(0, id);
-        c_out->send([this, id]{
+        c_out->send(RequestPriority::INTERACTIVE, [this, id]{
             try {
                 c_out->recv_acceptGroupInvitation();
             } catch (line::TalkException &err) {
@@ -204,18 +335,17 @@ void PurpleLine::join_chat(GHashTable *components) {
                 return;
             }
 
-            c_out->send_getGroup(id);
-            c_out->send([this]{
-                line::Group group;
-                c_out->recv_getGroup(group);
-
+            // Joining changed the group, so whatever is known about it is out of date
+            group_cache.invalidate(id);
+            group_cache.get(id, [this, id](line::Group &group) {
                 if (!group.__isset.id) {
-                    purple_debug_warning("line", "Couldn't get group: %s\n", group.id.c_str());
+                    purple_debug_warning("line", "Couldn't get group: %s\n", id.c_str());
                     return;
                 }
 
-                join_chat_success(ChatType::GROUP, group.id);
-            });
+                blist_update_chat(std::move(group));
+                join_chat_success(ChatType::GROUP, id);
+            }, RequestPriority::INTERACTIVE);
         });
 
         return;
@@ -253,7 +383,7 @@ void PurpleLine::reject_chat(GHashTable *components) {
     std::string id(id_ptr);
 
     c_out->send_rejectGroupInvitation(0, id);
-    c_out->send([this]() {
+    c_out->send(RequestPriority::INTERACTIVE, [this]() {
         try {
             c_out->recv_rejectGroupInvitation();
         } catch (line::TalkException &err) {
@@ -22,6 +22,16 @@ void PurpleLine::register_commands() {
         "Shows more chat history. Optional argument specifies number of messages to show.",
         nullptr);
 
+    purple_cmd_register(
+        "linestats",
+        "",
+        PURPLE_CMD_P_PRPL,
+        (PurpleCmdFlag)(PURPLE_CMD_FLAG_PRPL_ONLY | PURPLE_CMD_FLAG_IM | PURPLE_CMD_FLAG_CHAT),
+        LINE_PRPL_ID,
+        WRAPPER(PurpleLine::cmd_linestats),
+        "Shows connection and request statistics.",
+        nullptr);
+
     purple_cmd_register(
         "open",
         "w",
@@ -63,10 +73,10 @@ PurpleCmdRet PurpleLine::cmd_sticker(PurpleConversation *conv,
     msg.contentType = line::ContentType::STICKER;
     msg.to = purple_conversation_get_name(conv);
 
-    write_message(msg, false);
-
     send_message(msg);
 
+    write_message(std::move(msg), false);
+
     return PURPLE_CMD_RET_OK;
 }
 
@@ -89,6 +99,78 @@ PurpleCmdRet PurpleLine::cmd_history(PurpleConversation *conv,
     return PURPLE_CMD_RET_OK;
 }
 
+static void write_transport_stats(std::ostream &out, const char *name,
+    const TransportStats &stats)
+{
+    out
+        << name << ": " << stats.requests << " requests, " << stats.responses << " responses, "
+        << stats.bytes_out / 1024 << " KiB out, " << stats.bytes_in / 1024 << " KiB in, "
+        << stats.connects << " connects, " << stats.reconnects << " reconnects, "
+        << stats.timeouts << " timeouts, queue max " << stats.queue_high_water << "\n"
+        << "  queue " << stats.queue_time.summary() << "\n"
+        << "  wire " << stats.wire_time.summary() << "\n";
+}
+
+static void write_client_stats(std::ostream &out, const char *name, const ThriftClient &client) {
+    write_transport_stats(out, name, client.transport_stats());
+
+    const RetrySupervisor::Counters &retry = client.supervisor().counters();
+
+    out
+        << "  compressed " << client.compressed_bytes() / 1024 << " KiB -> "
+            << client.uncompressed_bytes() / 1024 << " KiB\n"
+        << "  retries: " << retry.failures << " failures, " << retry.fast_retries << " fast, "
+            << retry.delayed_retries << " delayed, circuit opened " << retry.opened << "\n";
+
+    for (auto &i: client.call_stats()) {
+        out
+            << "  " << i.first << ": " << i.second.calls << " calls\n"
+            << "    queue " << i.second.queue_time.summary() << "\n"
+            << "    wire " << i.second.wire_time.summary() << "\n";
+    }
+}
+
+PurpleCmdRet PurpleLine::cmd_linestats(PurpleConversation *conv,
+    const gchar *, gchar **, gchar **, void *)
+{
+    std::ostringstream out;
+
+    write_client_stats(out, "Commands", *c_out);
+    write_client_stats(out, "Poll", poller.thrift_client());
+    write_transport_stats(out, "Uploads", os_http.stats());
+    write_transport_stats(out, "Downloads", http.stats());
+
+    out
+        << "Message delivery " << poller.delivery_latency().summary() << "\n"
+        << "  write_message " << poller.write_time().summary() << "\n";
+
+    // Keep line breaks and indentation when shown as HTML
+    std::string text = markup_escape(out.str());
+    std::string html;
+    bool indent = true;
+
+    for (char c: text) {
+        if (c == '\n') {
+            html += "<br>";
+            indent = true;
+        } else if (c == ' ' && indent) {
+            html += "&nbsp;";
+        } else {
+            html += c;
+            indent = false;
+        }
+    }
+
+    purple_conversation_write(
+        conv,
+        "",
+        html.c_str(),
+        (PurpleMessageFlags)(PURPLE_MESSAGE_SYSTEM | PURPLE_MESSAGE_NO_LOG),
+        time(NULL));
+
+    return PURPLE_CMD_RET_OK;
+}
+
 PurpleCmdRet PurpleLine::cmd_open(PurpleConversation *conv,
     const gchar *, gchar **args, gchar **error, void *)
 {
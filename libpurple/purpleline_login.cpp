@@ -1,4 +1,5 @@
 #include "purpleline.hpp"
+#include "wrapper.hpp"
 
 #include <sstream>
 #include <iomanip>
@@ -31,6 +32,11 @@ static std::string bytes_to_hex(std::string bytes)
 
 void PurpleLine::login_start()
 {
+    tracer.stage("login_start");
+
+    // Show what was known last time right away, while syncing
+    load_snapshot();
+
     purple_connection_set_state(conn, PURPLE_CONNECTING);
     purple_connection_update_progress(conn, "Logging in", 0, 3);
 
@@ -88,6 +94,8 @@ void PurpleLine::login_start()
 
 void PurpleLine::get_auth_token()
 {
+    tracer.stage("get_auth_token");
+
     purple_debug_info("line", "Logging in with credentials to get new auth token.\n");
 
     c_out->close();
@@ -315,6 +323,8 @@ std::string PurpleLine::get_encrypted_credentials(line::RSAKey &key) {
 }
 
 void PurpleLine::set_auth_token(std::string auth_token) {
+        tracer.stage("set_auth_token");
+
         purple_account_set_string(acct, LINE_ACCOUNT_AUTH_TOKEN, auth_token.c_str());
 
         // Re-open output client to update persistent headers
@@ -324,6 +334,8 @@ void PurpleLine::set_auth_token(std::string auth_token) {
 }
 
 void PurpleLine::get_last_op_revision() {
+        tracer.stage("get_last_op_revision");
+
         c_out->send_getLastOpRevision();
         c_out->send([this]() {
             poller.set_local_rev(c_out->recv_getLastOpRevision());
@@ -333,6 +345,8 @@ void PurpleLine::get_last_op_revision() {
 }
 
 void PurpleLine::get_profile() {
+        tracer.stage("get_profile");
+
         c_out->send_getProfile();
         c_out->send([this]() {
             c_out->recv_getProfile(profile);
@@ -371,80 +385,285 @@ void PurpleLine::get_profile() {
                 // TODO: Delete icon
             }
 
+            catch_up_snapshot(snapshot_rev, 0);
+        });
+}
+
+// Records which contact or group an operation changed, if any
+static void note_change(const OperationView &op,
+    std::set<std::string> &contacts, std::set<std::string> &groups)
+{
+        switch (op.type) {
+            case line::OpType::NOTIFIED_UPDATE_PROFILE:
+            case line::OpType::ADD_CONTACT:
+            case line::OpType::BLOCK_CONTACT:
+            case line::OpType::UNBLOCK_CONTACT:
+            case line::OpType::UPDATE_CONTACT:
+                contacts.insert(op.param1.str());
+                break;
+
+            case line::OpType::CREATE_GROUP:
+            case line::OpType::UPDATE_GROUP:
+            case line::OpType::NOTIFIED_UPDATE_GROUP:
+            case line::OpType::INVITE_INTO_GROUP:
+            case line::OpType::NOTIFIED_INVITE_INTO_GROUP:
+            case line::OpType::LEAVE_GROUP:
+            case line::OpType::NOTIFIED_LEAVE_GROUP:
+            case line::OpType::ACCEPT_GROUP_INVITATION:
+            case line::OpType::NOTIFIED_ACCEPT_GROUP_INVITATION:
+            case line::OpType::KICKOUT_FROM_GROUP:
+            case line::OpType::NOTIFIED_KICKOUT_FROM_GROUP:
+            case line::OpType::CANCEL_INVITATION_GROUP:
+            case line::OpType::NOTIFIED_CANCEL_INVITATION_GROUP:
+                groups.insert(op.param1.str());
+                break;
+
+            default:
+                break;
+        }
+}
+
+// Goes through the operations since the snapshot up to the current revision, and notes what they
+// changed so that only that has to be fetched.
+void PurpleLine::catch_up_snapshot(int64_t rev, int seen) {
+        int64_t current_rev = poller.get_local_rev();
+
+        if (snapshot_rev < 0 || snapshot_stale || rev >= current_rev) {
+            // A snapshot from the future means the account was reset somehow
+            if (snapshot_rev > current_rev)
+                snapshot_stale = true;
+
+            get_contacts();
+            return;
+        }
+
+        if (seen == 0) {
+            gint64 age = g_get_real_time() / G_USEC_PER_SEC - snapshot_time;
+
+            if (age < 0 || age > LINE_SNAPSHOT_MAX_AGE
+                || current_rev - snapshot_rev > LINE_SNAPSHOT_CATCHUP_MAX)
+            {
+                purple_debug_info("line", "Snapshot too old, syncing everything.\n");
+
+                snapshot_stale = true;
+                get_contacts();
+                return;
+            }
+        }
+
+        if (seen >= LINE_SNAPSHOT_CATCHUP_MAX) {
+            purple_debug_info("line", "Over %d changes since snapshot, syncing everything.\n",
+                LINE_SNAPSHOT_CATCHUP_MAX);
+
+            snapshot_stale = true;
             get_contacts();
+            return;
+        }
+
+        if (seen == 0)
+            tracer.stage("catch_up_snapshot");
+
+        c_out->send_fetchOperations(rev, 100);
+        c_out->send(RequestPriority::BACKGROUND, [this, rev, seen]() {
+            OperationList operations;
+
+            try
+            {
+                c_out->recv_fetchOperations(operations);
+            }
+            catch (line::TalkException &err)
+            {
+                // Most likely the snapshot is too old for the server to have its operations
+                purple_debug_info("line", "Couldn't fetch changes since snapshot: %s\n",
+                    err.reason.c_str());
+
+                snapshot_stale = true;
+                get_contacts();
+                return;
+            }
+
+            int64_t last_rev = rev;
+
+            for (const OperationView &op : operations)
+            {
+                note_change(op, changed_contacts, changed_groups);
+
+                if (op.revision > last_rev)
+                    last_rev = op.revision;
+            }
+
+            if (last_rev == rev)
+            {
+                // Nothing more to go through
+                get_contacts();
+                return;
+            }
+
+            catch_up_snapshot(last_rev, seen + (int)operations.size());
         });
 }
 
 void PurpleLine::get_contacts() {
+        tracer.stage("get_contacts");
+
         c_out->send_getAllContactIds();
-        c_out->send([this]() {
+        c_out->send(RequestPriority::BACKGROUND, [this]() {
             std::vector<std::string> uids;
             c_out->recv_getAllContactIds(uids);
 
-            c_out->send_getContacts(uids);
-            c_out->send([this]() {
-                std::vector<line::Contact> contacts;
-                c_out->recv_getContacts(contacts);
-
-                std::set<PurpleBuddy *> buddies_to_delete = blist_find<PurpleBuddy>();
+            // With a snapshot, only contacts that are new or changed since need to be fetched
+            std::vector<std::string> fetch;
 
-                for (line::Contact &contact : contacts)
+            for (std::string &uid : uids)
+            {
+                if (snapshot_rev < 0 || snapshot_stale
+                    || contacts.count(uid) == 0 || changed_contacts.count(uid) == 1)
                 {
-                    if (contact.status == line::ContactStatus::FRIEND)
-                        buddies_to_delete.erase(blist_update_buddy(contact));
+                    fetch.push_back(uid);
                 }
+            }
 
-                for (PurpleBuddy *buddy : buddies_to_delete)
-                    blist_remove_buddy(purple_buddy_get_name(buddy));
-
-                {
-                    // Add self as buddy for those lonely debugging conversations
-                    // TODO: Remove
-
-                    line::Contact self;
-                    self.mid = profile.mid;
-                    self.displayName = profile.displayName + " [Profile]";
-                    self.statusMessage = profile.statusMessage;
-                    self.picturePath = profile.picturePath;
+            if (fetch.empty())
+            {
+                std::vector<line::Contact> none;
+                update_contacts(uids, none);
+                return;
+            }
 
-                    blist_update_buddy(self);
-                }
+            c_out->send_getContacts(fetch);
+            c_out->send(RequestPriority::BACKGROUND, [this, uids]() {
+                std::vector<line::Contact> fetched;
+                c_out->recv_getContacts(fetched);
 
-                get_groups();
+                update_contacts(uids, fetched);
             });
         });
 }
 
+void PurpleLine::update_contacts(const std::vector<std::string> &uids,
+    std::vector<line::Contact> &fetched)
+{
+        std::set<PurpleBuddy *> buddies_to_delete = blist_find<PurpleBuddy>();
+
+        for (line::Contact &contact : fetched)
+        {
+            if (contact.status == line::ContactStatus::FRIEND)
+                buddies_to_delete.erase(blist_update_buddy(std::move(contact)));
+        }
+
+        // Contacts kept from the snapshot are already on the buddy list, and now known to be
+        // up to date unless they changed
+        for (const std::string &uid : uids)
+        {
+            auto known = contacts.find(uid);
+            if (known == contacts.end())
+                continue;
+
+            if (!snapshot_stale && changed_contacts.count(uid) == 0)
+                contact_cache.stored(uid);
+
+            if (known->second.status == line::ContactStatus::FRIEND)
+                buddies_to_delete.erase(purple_find_buddy(acct, uid.c_str()));
+        }
+
+        for (PurpleBuddy *buddy : buddies_to_delete)
+            blist_remove_buddy(purple_buddy_get_name(buddy));
+
+        {
+            // Add self as buddy for those lonely debugging conversations
+            // TODO: Remove
+
+            line::Contact self;
+            self.mid = profile.mid;
+            self.displayName = profile.displayName + " [Profile]";
+            self.statusMessage = profile.statusMessage;
+            self.picturePath = profile.picturePath;
+
+            blist_update_buddy(std::move(self));
+        }
+
+        get_groups();
+}
+
 void PurpleLine::get_groups() {
+        tracer.stage("get_groups");
+
         c_out->send_getGroupIdsJoined();
-        c_out->send([this]() {
+        c_out->send(RequestPriority::BACKGROUND, [this]() {
             std::vector<std::string> gids;
             c_out->recv_getGroupIdsJoined(gids);
 
-            c_out->send_getGroups(gids);
-            c_out->send([this]() {
-                std::vector<line::Group> groups;
-                c_out->recv_getGroups(groups);
+            // Same as for contacts, only new and changed groups are fetched if there's a snapshot
+            std::vector<std::string> fetch;
 
-                std::set<PurpleChat *> chats_to_delete = blist_find_chats_by_type(ChatType::GROUP);
-
-                for (line::Group &group : groups)
-                    chats_to_delete.erase(blist_update_chat(group));
+            for (std::string &gid : gids)
+            {
+                if (snapshot_rev < 0 || snapshot_stale
+                    || groups.count(gid) == 0 || changed_groups.count(gid) == 1)
+                {
+                    fetch.push_back(gid);
+                }
+            }
 
-                for (PurpleChat *chat : chats_to_delete)
-                    purple_blist_remove_chat(chat);
+            if (fetch.empty())
+            {
+                std::vector<line::Group> none;
+                update_groups(gids, none);
+                return;
+            }
 
-                // Revoked
-                //get_rooms();
+            c_out->send_getGroups(fetch);
+            c_out->send(RequestPriority::BACKGROUND, [this, gids]() {
+                std::vector<line::Group> fetched;
+                c_out->recv_getGroups(fetched);
 
-                get_group_invites();
+                update_groups(gids, fetched);
             });
         });
 }
+
+void PurpleLine::update_groups(const std::vector<std::string> &gids,
+    std::vector<line::Group> &fetched)
+{
+        std::set<PurpleChat *> chats_to_delete = blist_find_chats_by_type(ChatType::GROUP);
+
+        for (line::Group &group : fetched)
+            chats_to_delete.erase(blist_update_chat(std::move(group)));
+
+        // Groups kept from the snapshot are already on the buddy list. Any others it had were
+        // left since.
+        std::set<std::string> joined(gids.begin(), gids.end());
+
+        for (auto i = groups.begin(); i != groups.end(); )
+        {
+            if (joined.count(i->first))
+            {
+                if (!snapshot_stale && changed_groups.count(i->first) == 0)
+                    group_cache.stored(i->first);
+
+                chats_to_delete.erase(blist_find_chat(i->first, ChatType::GROUP));
+                ++i;
+            }
+            else
+            {
+                i = groups.erase(i);
+            }
+        }
+
+        for (PurpleChat *chat : chats_to_delete)
+            purple_blist_remove_chat(chat);
+
+        // Revoked
+        //get_rooms();
+
+        get_group_invites();
+}
 /*
 void PurpleLine::get_rooms() {
+        tracer.stage("get_rooms");
+
         c_out->send_getMessageBoxCompactWrapUpList(1, 65535);
-        c_out->send([this]() {
+        c_out->send(RequestPriority::BACKGROUND, [this]() {
             line::MessageBoxWrapUpList wrap_up_list;
             c_out->recv_getMessageBoxCompactWrapUpList(wrap_up_list);
 
@@ -464,7 +683,7 @@ void PurpleLine::get_rooms() {
                 // Room contacts don't contain full contact information, so pull separately to get names
 
                 c_out->send_getContacts(std::vector<std::string>(uids.begin(), uids.end()));
-                c_out->send([this, wrap_up_list] {
+                c_out->send(RequestPriority::BACKGROUND, [this, wrap_up_list] {
                     std::vector<line::Contact> contacts;
                     c_out->recv_getContacts(contacts);
 
@@ -482,6 +701,8 @@ void PurpleLine::get_rooms() {
 }
 
 void PurpleLine::update_rooms(line::MessageBoxWrapUpList wrap_up_list) {
+        tracer.stage("update_rooms");
+
         std::set<PurpleChat *> chats_to_delete = blist_find_chats_by_type(ChatType::ROOM);
 
         for (line::MessageBoxWrapUp &ent : wrap_up_list.messageBoxWrapUpList)
@@ -503,8 +724,10 @@ void PurpleLine::update_rooms(line::MessageBoxWrapUpList wrap_up_list) {
 }
 */
 void PurpleLine::get_group_invites() {
+        tracer.stage("get_group_invites");
+
         c_out->send_getGroupIdsInvited();
-        c_out->send([this]() {
+        c_out->send(RequestPriority::BACKGROUND, [this]() {
             std::vector<std::string> gids;
             c_out->recv_getGroupIdsInvited(gids);
 
@@ -515,7 +738,7 @@ void PurpleLine::get_group_invites() {
             }
 
             c_out->send_getGroups(gids);
-            c_out->send([this]() {
+            c_out->send(RequestPriority::BACKGROUND, [this]() {
                 std::vector<line::Group> groups;
                 c_out->recv_getGroups(groups);
 
@@ -528,7 +751,125 @@ void PurpleLine::get_group_invites() {
 }
 
 void PurpleLine::login_done() {
+        tracer.stage(nullptr);
+
+        synced_rev = poller.get_local_rev();
+
+        changed_contacts.clear();
+        changed_groups.clear();
+
+        snapshot_changed();
+
         poller.start();
 
         purple_connection_update_progress(conn, "Connected", 2, 3);
 }
+
+// e.g. ~/.purple/line/user%40example.com.snapshot
+std::string PurpleLine::snapshot_path() {
+        std::string name = purple_escape_filename(purple_account_get_username(acct));
+        name += ".snapshot";
+
+        gchar *path_p = g_build_filename(purple_user_dir(), "line", name.c_str(), nullptr);
+        std::string path(path_p);
+        g_free(path_p);
+
+        return path;
+}
+
+void PurpleLine::load_snapshot() {
+        line::Snapshot snapshot;
+        std::string error;
+
+        if (!AccountSnapshot::load(snapshot_path(), snapshot, error)) {
+            if (!error.empty())
+                purple_debug_warning("line", "Ignoring snapshot: %s\n", error.c_str());
+
+            return;
+        }
+
+        purple_debug_info("line", "Loaded snapshot at revision %lld: %u contacts, %u groups\n",
+            (long long)snapshot.revision,
+            (unsigned)snapshot.contacts.size(),
+            (unsigned)snapshot.groups.size());
+
+        snapshot_rev = snapshot.revision;
+        snapshot_time = snapshot.savedTime;
+
+        profile = std::move(snapshot.profile);
+        profile_contact.mid = profile.mid;
+        profile_contact.displayName = profile.displayName;
+
+        // Nothing from the snapshot is served as fresh until syncing has confirmed it's unchanged
+        for (line::Contact &contact : snapshot.contacts)
+        {
+            std::string mid = contact.mid;
+
+            if (contact.status == line::ContactStatus::FRIEND || mid == profile.mid)
+                blist_update_buddy(std::move(contact));
+            else
+                contacts[mid] = std::move(contact);
+
+            contact_cache.invalidate(mid);
+        }
+
+        for (line::Group &group : snapshot.groups)
+        {
+            std::string id = group.id;
+
+            blist_update_chat(std::move(group));
+            group_cache.invalidate(id);
+        }
+}
+
+// Saves the snapshot LINE_SNAPSHOT_SAVE_DELAY seconds after the first of a burst of changes, so
+// that the burst is saved once. Nothing is saved until login has synced everything. If the account
+// is closed first, the next login goes through the changes again from the last saved revision.
+void PurpleLine::snapshot_changed() {
+        if (!logged_in() || snapshot_save_timeout)
+            return;
+
+        snapshot_save_timeout = purple_timeout_add_seconds(LINE_SNAPSHOT_SAVE_DELAY,
+            WRAPPER(PurpleLine::snapshot_save_cb), (gpointer)this);
+}
+
+int PurpleLine::snapshot_save_cb() {
+        // Entities still being fetched may be for operations that the current revision includes,
+        // so wait for them
+        if (contact_cache.busy() || group_cache.busy())
+            return TRUE;
+
+        snapshot_save_timeout = 0;
+
+        save_snapshot();
+
+        return FALSE;
+}
+
+void PurpleLine::save_snapshot() {
+        line::Snapshot snapshot;
+
+        snapshot.revision = poller.get_local_rev();
+        snapshot.savedTime = g_get_real_time() / G_USEC_PER_SEC;
+        snapshot.profile = profile;
+
+        // Deleted contacts and groups that have been left are kept around in memory, but aren't
+        // worth loading again. Rooms aren't saved at all, as they're fetched at login anyway.
+        for (auto &i : contacts) {
+            if (i.second.status != line::ContactStatus::DELETED
+                && i.second.status != line::ContactStatus::DELETED_BLOCKED)
+            {
+                snapshot.contacts.push_back(i.second);
+            }
+        }
+
+        for (auto &i : groups) {
+            if (!i.second.id.empty() && blist_find_chat(i.first, ChatType::GROUP))
+                snapshot.groups.push_back(i.second);
+        }
+
+        std::string error;
+
+        if (!AccountSnapshot::save(snapshot_path(), snapshot, error))
+            purple_debug_warning("line", "Couldn't save snapshot: %s\n", error.c_str());
+}
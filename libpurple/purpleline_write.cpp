@@ -62,7 +62,7 @@ void PurpleLine::write_e2ee_error(PurpleConversation *conv) {
     purple_conversation_set_data(conv, "line-e2ee-error-shown", GINT_TO_POINTER(1));
 }
 
-void PurpleLine::write_message(line::Message &msg, bool replay) {
+bool PurpleLine::write_message(line::Message &&msg, bool replay) {
     std::string text;
     int flags = 0;
     time_t mtime = (time_t)(msg.createdTime / 1000);
@@ -73,7 +73,7 @@ void PurpleLine::write_message(line::Message &msg, bool replay) {
         != recent_messages.cend())
     {
         // We already processed this message. User is probably talking with himself.
-        return;
+        return false;
     }
 
     // Hack
@@ -96,8 +96,8 @@ void PurpleLine::write_message(line::Message &msg, bool replay) {
             purple_conversation_get_data(conv, "line-message-queue");
 
         if (queue) {
-            queue->push_back(msg);
-            return;
+            queue->push_back(std::move(msg));
+            return false;
         }
     }
 
@@ -297,6 +297,8 @@ void PurpleLine::write_message(line::Message &msg, bool replay) {
             }
         }
     }
+
+    return true;
 }
 
 void PurpleLine::write_message(PurpleConversation *conv, std::string &from, std::string &text,
@@ -0,0 +1,49 @@
+#include <string.h>
+
+#include "readbuffer.hpp"
+
+ReadBuffer::ReadBuffer() :
+    start(0),
+    end(0)
+{
+}
+
+uint8_t *ReadBuffer::prepare(size_t min_space) {
+    if (buf.size() - end < min_space) {
+        size_t unread = end - start;
+
+        if (start > 0 && buf.size() - unread >= min_space) {
+            // Enough room if the unread data is moved to the front
+            memmove(buf.data(), buf.data() + start, unread);
+        } else {
+            size_t new_size = buf.size() ? buf.size() : min_space;
+            while (new_size - unread < min_space)
+                new_size *= 2;
+
+            std::vector<uint8_t> new_buf(new_size);
+            if (unread)
+                memcpy(new_buf.data(), buf.data() + start, unread);
+            buf.swap(new_buf);
+        }
+
+        start = 0;
+        end = unread;
+    }
+
+    return buf.data() + end;
+}
+
+void ReadBuffer::commit(size_t len) {
+    end += len;
+}
+
+void ReadBuffer::consume(size_t len) {
+    start += len;
+
+    if (start >= end)
+        start = end = 0;
+}
+
+void ReadBuffer::clear() {
+    start = end = 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Growable receive buffer. Data is appended at the end and consumed from the front, and the unread
+// bytes are always contiguous so that they can be lent out to a parser without copying.
+class ReadBuffer {
+
+    std::vector<uint8_t> buf;
+    size_t start;
+    size_t end;
+
+public:
+
+    ReadBuffer();
+
+    // Returns a pointer to at least min_space writable bytes after the unread data. Call commit()
+    // with the number of bytes actually written.
+    uint8_t *prepare(size_t min_space);
+    void commit(size_t len);
+
+    uint8_t *data() { return buf.data() + start; }
+    const uint8_t *data() const { return buf.data() + start; }
+    size_t size() const { return end - start; }
+
+    void consume(size_t len);
+    void clear();
+
+};
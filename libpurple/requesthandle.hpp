@@ -0,0 +1,37 @@
+#pragma once
+
+#include <memory>
+
+// Requests are sent in priority order. A waiting request is eventually treated as more urgent than
+// a newer one of a higher priority, so that lower priorities can't be starved.
+enum class RequestPriority {
+    INTERACTIVE = 0,
+    NORMAL = 1,
+    BACKGROUND = 2,
+};
+
+// Refers to a request made with LineHttpTransport::request. Cancelling a request that hasn't been
+// sent yet drops it, and one that is already on the wire has its response thrown away without
+// calling the callback.
+class RequestHandle {
+
+    friend class LineHttpTransport;
+
+    struct State {
+        bool cancelled;
+        bool done;
+    };
+
+    std::shared_ptr<State> state;
+
+public:
+
+    void cancel() { if (state) state->cancelled = true; }
+    bool cancelled() const { return state && state->cancelled; }
+
+    // True once the request has been answered, cancelled or given up on
+    bool done() const { return !state || state->done; }
+
+    bool operator==(const RequestHandle &other) const { return state == other.state; }
+
+};
@@ -0,0 +1,71 @@
+#include <algorithm>
+
+#include <debug.h>
+
+#include "constants.hpp"
+#include "retrysupervisor.hpp"
+
+static const char *state_names[] = { "closed", "open", "half-open" };
+
+RetrySupervisor::RetrySupervisor(std::string name) :
+    name(name),
+    state_(State::CLOSED),
+    consecutive_failures(0),
+    counters_()
+{
+}
+
+void RetrySupervisor::set_state(State state) {
+    if (state == state_)
+        return;
+
+    purple_debug_info("line", "%s: circuit %s -> %s after %d failures.\n",
+        name.c_str(), state_names[(int)state_], state_names[(int)state], consecutive_failures);
+
+    state_ = state;
+
+    switch (state) {
+        case State::CLOSED: counters_.closed++; break;
+        case State::OPEN: counters_.opened++; break;
+        case State::HALF_OPEN: counters_.half_opened++; break;
+    }
+}
+
+guint RetrySupervisor::failure() {
+    counters_.failures++;
+    consecutive_failures++;
+
+    if (state_ == State::HALF_OPEN
+        || (state_ == State::CLOSED && consecutive_failures >= LINE_RETRY_CIRCUIT_FAILURES))
+    {
+        set_state(State::OPEN);
+    }
+
+    if (consecutive_failures == 1) {
+        counters_.fast_retries++;
+        return 0;
+    }
+
+    counters_.delayed_retries++;
+
+    guint delay = LINE_RETRY_MAX_DELAY;
+
+    if (state_ == State::CLOSED) {
+        int doublings = std::min(consecutive_failures - 2, 16);
+        delay = std::min(delay, (guint)LINE_RETRY_MIN_DELAY << doublings);
+    }
+
+    // Wait at least half of the delay
+    return delay / 2 + (guint)g_random_int_range(0, delay / 2 + 1);
+}
+
+void RetrySupervisor::retrying() {
+    if (state_ == State::OPEN)
+        set_state(State::HALF_OPEN);
+}
+
+void RetrySupervisor::success() {
+    consecutive_failures = 0;
+
+    set_state(State::CLOSED);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+
+#include <glib.h>
+
+// Decides how long to wait before retrying after a failure. The first failure is retried right
+// away, after that the delay doubles up to a limit, with random jitter so that connections don't
+// retry in lockstep. After enough failures in a row the circuit opens: retries only happen at the
+// longest delay, and the first one is a probe that either closes the circuit again or reopens it.
+class RetrySupervisor {
+
+public:
+
+    enum class State {
+        CLOSED = 0,
+        OPEN = 1,
+        HALF_OPEN = 2,
+    };
+
+    struct Counters {
+        int failures;
+        int fast_retries;
+        int delayed_retries;
+        int opened;
+        int half_opened;
+        int closed;
+    };
+
+private:
+
+    std::string name;
+
+    State state_;
+    int consecutive_failures;
+
+    Counters counters_;
+
+    void set_state(State state);
+
+public:
+
+    RetrySupervisor(std::string name);
+
+    // Records a failure and returns the number of milliseconds to wait before retrying
+    guint failure();
+
+    // Called when a delayed retry actually starts
+    void retrying();
+
+    void success();
+
+    State state() const { return state_; }
+    const Counters &counters() const { return counters_; }
+
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <stddef.h>
+
+// Double-ended queue in a single growable ring buffer. Unlike std::deque, which allocates a block
+// for every element or two when they're large, it only allocates when it grows past the most it
+// has ever held, so pushing and popping in a steady state doesn't touch the heap.
+template <typename T>
+class RingQueue {
+
+    using Slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+    std::unique_ptr<Slot[]> slots;
+    size_t capacity;
+    size_t head;
+    size_t count;
+
+    T *at(size_t i) { return reinterpret_cast<T *>(&slots[(head + i) & (capacity - 1)]); }
+
+    const T *at(size_t i) const {
+        return reinterpret_cast<const T *>(&slots[(head + i) & (capacity - 1)]);
+    }
+
+    void grow() {
+        size_t new_capacity = capacity ? capacity * 2 : 4;
+        std::unique_ptr<Slot[]> new_slots(new Slot[new_capacity]);
+
+        for (size_t i = 0; i < count; i++) {
+            T *item = at(i);
+
+            new (&new_slots[i]) T(std::move(*item));
+            item->~T();
+        }
+
+        slots = std::move(new_slots);
+        capacity = new_capacity;
+        head = 0;
+    }
+
+public:
+
+    RingQueue() : capacity(0), head(0), count(0) { }
+
+    RingQueue(const RingQueue &) = delete;
+    RingQueue &operator=(const RingQueue &) = delete;
+
+    ~RingQueue() { clear(); }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    T &front() { return *at(0); }
+    T &back() { return *at(count - 1); }
+    const T &front() const { return *at(0); }
+    const T &back() const { return *at(count - 1); }
+
+    T &operator[](size_t i) { return *at(i); }
+    const T &operator[](size_t i) const { return *at(i); }
+
+    void push_back(T &&item) {
+        if (count == capacity)
+            grow();
+
+        new (at(count)) T(std::move(item));
+        count++;
+    }
+
+    void push_front(T &&item) {
+        if (count == capacity)
+            grow();
+
+        head = (head + capacity - 1) & (capacity - 1);
+        new (at(0)) T(std::move(item));
+        count++;
+    }
+
+    void pop_front() {
+        at(0)->~T();
+        head = (head + 1) & (capacity - 1);
+        count--;
+    }
+
+    void pop_back() {
+        at(count - 1)->~T();
+        count--;
+    }
+
+    void clear() {
+        while (count > 0)
+            pop_back();
+    }
+
+};
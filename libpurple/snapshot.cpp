@@ -0,0 +1,167 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <zlib.h>
+
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+#include "snapshot.hpp"
+
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+
+static const char MAGIC[4] = { 'L', 'S', 'N', 'P' };
+
+// Bump when line::Snapshot or anything in it changes incompatibly
+static const uint32_t VERSION = 1;
+
+// Magic, version, CRC-32 and length of the payload, all little-endian
+static const size_t HEADER_SIZE = 4 + 4 + 4 + 8;
+
+static void put_le(std::string &out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        out.push_back((char)((value >> (i * 8)) & 0xff));
+}
+
+static uint64_t get_le(const uint8_t *in, int bytes) {
+    uint64_t value = 0;
+
+    for (int i = 0; i < bytes; i++)
+        value |= (uint64_t)in[i] << (i * 8);
+
+    return value;
+}
+
+// Writes a temporary file first and renames it over the old one, so that a crash while saving
+// can't leave half a snapshot behind
+static bool write_file(const std::string &path, const std::string &data, std::string &error) {
+    std::string temp = path + ".save";
+
+    int fd = g_open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        error = g_strerror(errno);
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        written += (size_t)n;
+    }
+
+    bool ok = (written == data.size());
+    int saved_errno = errno;
+
+    if (close(fd) != 0 && ok) {
+        ok = false;
+        saved_errno = errno;
+    }
+
+    if (!ok) {
+        error = g_strerror(saved_errno);
+        g_unlink(temp.c_str());
+        return false;
+    }
+
+    if (g_rename(temp.c_str(), path.c_str()) != 0) {
+        error = g_strerror(errno);
+        g_unlink(temp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool AccountSnapshot::load(const std::string &path, line::Snapshot &snapshot,
+    std::string &error)
+{
+    GError *open_error = nullptr;
+
+    GMappedFile *file = g_mapped_file_new(path.c_str(), FALSE, &open_error);
+    if (!file) {
+        // Not having one yet is normal
+        if (!g_error_matches(open_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            error = open_error->message;
+
+        g_error_free(open_error);
+        return false;
+    }
+
+    const uint8_t *data = (const uint8_t *)g_mapped_file_get_contents(file);
+    size_t size = g_mapped_file_get_length(file);
+
+    bool ok = false;
+
+    if (size < HEADER_SIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+        error = "not a snapshot";
+    } else if (get_le(data + 4, 4) != VERSION) {
+        error = "format version " + std::to_string(get_le(data + 4, 4));
+    } else {
+        uint32_t crc = (uint32_t)get_le(data + 8, 4);
+        uint64_t length = get_le(data + 12, 8);
+
+        const uint8_t *payload = data + HEADER_SIZE;
+
+        if (length != size - HEADER_SIZE
+            || crc != (uint32_t)crc32(crc32(0, nullptr, 0), payload, (uInt)length))
+        {
+            error = "checksum mismatch";
+        } else {
+            try {
+                auto buffer = std::make_shared<TMemoryBuffer>(
+                    const_cast<uint8_t *>(payload), (uint32_t)length);
+                TCompactProtocol protocol(buffer);
+
+                snapshot.read(&protocol);
+                ok = true;
+            } catch (apache::thrift::TException &err) {
+                error = err.what();
+            }
+        }
+    }
+
+    g_mapped_file_unref(file);
+
+    return ok;
+}
+
+bool AccountSnapshot::save(const std::string &path, const line::Snapshot &snapshot,
+    std::string &error)
+{
+    auto buffer = std::make_shared<TMemoryBuffer>();
+    TCompactProtocol protocol(buffer);
+
+    snapshot.write(&protocol);
+
+    uint8_t *payload;
+    uint32_t length;
+    buffer->getBuffer(&payload, &length);
+
+    std::string data;
+    data.reserve(HEADER_SIZE + length);
+
+    data.append(MAGIC, sizeof(MAGIC));
+    put_le(data, VERSION, 4);
+    put_le(data, crc32(crc32(0, nullptr, 0), payload, length), 4);
+    put_le(data, length, 8);
+    data.append((const char *)payload, length);
+
+    gchar *dir = g_path_get_dirname(path.c_str());
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    return write_file(path, data, error);
+}
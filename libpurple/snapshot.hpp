@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+
+#include "thrift_line/TalkService.h"
+
+// The profile, contacts and groups of an account as of an operation revision, saved a while after
+// they change so that the next login can show the buddy list right away and only fetch what
+// changed since.
+//
+// The file is a small header (magic, format version, CRC-32 and length of the rest) followed by a
+// line::Snapshot in the compact protocol. Anything that doesn't check out is ignored, and the
+// account is synced from scratch as if there was no snapshot.
+//
+// Only needs glib, zlib and the generated code, so that it can be tested on its own. Logging is up
+// to the caller.
+class AccountSnapshot {
+
+public:
+
+    // Returns false if there's no usable snapshot at path. error says why, or is left empty if
+    // there just isn't one.
+    static bool load(const std::string &path, line::Snapshot &snapshot, std::string &error);
+
+    // Replaces any snapshot at path with a file that only the user can read
+    static bool save(const std::string &path, const line::Snapshot &snapshot, std::string &error);
+
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+#include <stddef.h>
+
+// Fixed size lock-free queue for handing items from one thread to exactly one other. push() may
+// only be called from the producing thread and pop() only from the consuming one. Size must be a
+// power of two.
+template <typename T, size_t Size>
+class SpscQueue {
+
+    static_assert(Size && (Size & (Size - 1)) == 0, "Size must be a power of two");
+
+    T items[Size];
+
+    // Only ever increase. The producer owns tail and the consumer owns head.
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+
+public:
+
+    SpscQueue() : head(0), tail(0) { }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // Returns false and leaves item alone if the queue is full
+    bool push(T &&item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+
+        if (t - head.load(std::memory_order_acquire) == Size)
+            return false;
+
+        items[t & (Size - 1)] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty
+    bool pop(T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(items[h & (Size - 1)]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only a hint unless called from the consumer
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+};
@@ -0,0 +1,151 @@
+#include <memory>
+#include <string>
+
+#include "../arena.hpp"
+#include "../callback.hpp"
+#include "../orderedkeys.hpp"
+#include "../ringqueue.hpp"
+
+#include "alloccount.hpp"
+#include "check.hpp"
+
+// What sending a request goes through, once warmed up, shouldn't touch the heap
+
+// Stands in for the transport, which is the only one that can make live handles
+class LineHttpTransport {
+public:
+    static RequestHandle make_handle() {
+        RequestHandle handle;
+        handle.state = std::allocate_shared<RequestHandle::State>(
+            RecyclingAllocator<RequestHandle::State>(), RequestHandle::State { false, false });
+
+        return handle;
+    }
+
+    static void answer(RequestHandle &handle) {
+        handle.state->done = true;
+    }
+};
+
+// About the size of what the transport queues per request
+struct Request {
+    const char *method;
+    std::string body;
+    Callback<void(), 2 * CALLBACK_INLINE_SIZE> callback;
+    RequestHandle handle;
+};
+
+// About the size of ThriftClient's bookkeeping around a callback
+struct Completion {
+    void *client;
+    void *call;
+    Callback<void()> callback;
+
+    void operator()() { callback(); }
+};
+
+static const char *const MIDS[] = {
+    "u0123456789abcdef0123456789abcde0",
+    "u0123456789abcdef0123456789abcde1",
+    "c0123456789abcdef0123456789abcde2",
+};
+
+static int called = 0;
+
+static void round_trip(RingQueue<Request> &queue, OrderedKeys &ordered, std::string &key,
+    std::string &body, int i)
+{
+    key.assign(MIDS[i % 3]);
+
+    size_t lane;
+    if (!ordered.find(key, lane))
+        lane = (size_t)i % 2;
+
+    queue.push_back(Request());
+
+    Request &req = queue.back();
+    req.method = "POST";
+    req.body.swap(body);
+    req.callback = Completion { nullptr, nullptr, []() { called++; } };
+    req.handle = LineHttpTransport::make_handle();
+
+    ordered.sent(key, lane, req.handle);
+
+    // Answered in order, a couple of requests behind
+    while (queue.size() > 2) {
+        Request &head = queue.front();
+
+        LineHttpTransport::answer(head.handle);
+        ordered.answered(head.handle);
+        head.callback();
+
+        // Body buffers go back to be reused, like the transport's spare buffers
+        body.swap(head.body);
+        queue.pop_front();
+    }
+}
+
+static void test_steady_state() {
+    RingQueue<Request> queue;
+    OrderedKeys ordered;
+    std::string key;
+    std::string body(300, 'x');
+
+    for (int i = 0; i < 100; i++)
+        round_trip(queue, ordered, key, body, i);
+
+    size_t before = alloc_count;
+
+    for (int i = 0; i < 1000; i++)
+        round_trip(queue, ordered, key, body, i);
+
+    CHECK(alloc_count == before);
+    CHECK(called == 1100 - 2);
+}
+
+static void test_ordered_keys() {
+    OrderedKeys ordered;
+
+    RequestHandle first = LineHttpTransport::make_handle();
+    RequestHandle second = LineHttpTransport::make_handle();
+
+    size_t lane = 9;
+
+    ordered.sent(MIDS[0], 1, first);
+    CHECK(ordered.find(MIDS[0], lane) && lane == 1);
+    CHECK(!ordered.find(MIDS[1], lane));
+
+    // A later request with the same key takes over the entry
+    ordered.sent(MIDS[0], 1, second);
+
+    LineHttpTransport::answer(first);
+    ordered.answered(first);
+    CHECK(ordered.find(MIDS[0], lane) && lane == 1);
+
+    LineHttpTransport::answer(second);
+    ordered.answered(second);
+    CHECK(!ordered.find(MIDS[0], lane));
+
+    // Done without being answered, like a cancelled request
+    RequestHandle third = LineHttpTransport::make_handle();
+    ordered.sent(MIDS[2], 0, third);
+    LineHttpTransport::answer(third);
+    CHECK(!ordered.find(MIDS[2], lane));
+
+    RequestHandle fourth = LineHttpTransport::make_handle();
+    ordered.sent(MIDS[1], 1, fourth);
+    ordered.clear();
+    CHECK(!ordered.find(MIDS[1], lane));
+}
+
+int main() {
+    // Make sure the hook is in place
+    size_t before = alloc_count;
+    std::string counted(100, 'x');
+    CHECK(alloc_count == before + 1);
+
+    test_ordered_keys();
+    test_steady_state();
+
+    return check_result("alloc");
+}
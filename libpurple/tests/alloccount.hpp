@@ -0,0 +1,24 @@
+#pragma once
+
+#include <new>
+
+#include <stdlib.h>
+
+// Counts heap allocations by replacing the global operator new. Include in one file per test
+// binary only, since it defines the replacements.
+
+static size_t alloc_count = 0;
+
+void *operator new(size_t size) {
+    alloc_count++;
+
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdio.h>
+
+// Minimal checks for the standalone tests run by make check. A failed check is reported and
+// counted, and the test carries on.
+
+static int check_failures = 0;
+
+#define CHECK(expr) \
+    do { \
+        if (!(expr)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+            check_failures++; \
+        } \
+    } while (0)
+
+static inline int check_result(const char *name) {
+    if (check_failures) {
+        fprintf(stderr, "%s: %d checks failed\n", name, check_failures);
+        return 1;
+    }
+
+    printf("%s: ok\n", name);
+    return 0;
+}
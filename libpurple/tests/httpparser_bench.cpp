@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../httpparser.hpp"
+#include "../readbuffer.hpp"
+
+// Time to parse typical LINE responses, arriving at once and in TCP segment sized pieces. Run with
+// make bench.
+
+static const int RUNS = 100000;
+
+static size_t sink = 0;
+
+// Parses the response arriving step bytes at a time from a buffer kept between runs, the way the
+// transport does
+static void parse(HttpParser &parser, ReadBuffer &buf, const std::string &data, size_t step) {
+    parser.reset(true);
+
+    HttpParser::Result result = HttpParser::Result::NEED_MORE;
+
+    for (size_t i = 0; i < data.size(); i += step) {
+        size_t len = std::min(step, data.size() - i);
+
+        memcpy(buf.prepare(len), data.data() + i, len);
+        buf.commit(len);
+
+        result = parser.parse(buf.data(), buf.size());
+        if (result != HttpParser::Result::NEED_MORE)
+            break;
+    }
+
+    if (result != HttpParser::Result::DONE) {
+        printf("response didn't parse\n");
+        exit(1);
+    }
+
+    sink += parser.body_length();
+
+    buf.consume(parser.message_length());
+}
+
+static void measure(const char *name, const std::string &data, size_t step) {
+    HttpParser parser;
+    ReadBuffer buf;
+
+    for (int i = 0; i < RUNS / 10; i++)
+        parse(parser, buf, data, step);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < RUNS; i++)
+        parse(parser, buf, data, step);
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+    printf("%-32s %10.0f ns per response\n", name, elapsed.count() / RUNS);
+}
+
+int main() {
+    const std::string headers =
+        "HTTP/1.1 200 OK\r\n"
+        "Server: nginx\r\n"
+        "Date: Sat, 17 Oct 2026 12:00:00 GMT\r\n"
+        "Content-Type: application/x-thrift\r\n"
+        "Connection: keep-alive\r\n"
+        "X-LS: 0123456789abcdef0123456789abcdef\r\n";
+
+    std::string body(2000, 'x');
+
+    std::string with_length = headers
+        + "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        + "\r\n"
+        + body;
+
+    std::string chunked = headers + "Transfer-Encoding: chunked\r\n\r\n";
+    for (size_t i = 0; i < body.size(); i += 500)
+        chunked += "1f4\r\n" + body.substr(i, 500) + "\r\n";
+    chunked += "0\r\n\r\n";
+
+    measure("content-length, at once", with_length, with_length.size());
+    measure("content-length, 1460 byte pieces", with_length, 1460);
+    measure("chunked, at once", chunked, chunked.size());
+    measure("chunked, 1460 byte pieces", chunked, 1460);
+
+    return sink == 0;
+}
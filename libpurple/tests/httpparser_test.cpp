@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <string>
+
+#include <string.h>
+
+#include "../httpparser.hpp"
+#include "../readbuffer.hpp"
+
+#include "check.hpp"
+
+// Feeds a response to the parser step bytes at a time, the way the transport does as data arrives
+static HttpParser::Result feed(HttpParser &parser, ReadBuffer &buf, const std::string &data,
+    size_t step)
+{
+    HttpParser::Result result = HttpParser::Result::NEED_MORE;
+
+    for (size_t i = 0; i < data.size(); i += step) {
+        size_t len = std::min(step, data.size() - i);
+
+        memcpy(buf.prepare(len), data.data() + i, len);
+        buf.commit(len);
+
+        result = parser.parse(buf.data(), buf.size());
+        if (result != HttpParser::Result::NEED_MORE)
+            break;
+    }
+
+    return result;
+}
+
+static std::string body(HttpParser &parser, ReadBuffer &buf) {
+    return std::string((const char *)buf.data() + parser.body_start(), parser.body_length());
+}
+
+static void test_content_length(size_t step) {
+    HttpParser parser;
+    ReadBuffer buf;
+
+    parser.reset(true);
+
+    CHECK(feed(parser, buf,
+        "HTTP/1.1 200 OK\r\n"
+        "content-LENGTH:  5 \r\n"
+        "X-LS: abc\r\n"
+        "\r\n"
+        "hello", step) == HttpParser::Result::DONE);
+
+    CHECK(parser.status_code() == 200);
+    CHECK(parser.keep_alive());
+    CHECK(parser.has_x_ls());
+    CHECK(parser.x_ls() == "abc");
+    CHECK(body(parser, buf) == "hello");
+    CHECK(parser.message_length() == buf.size());
+}
+
+static void test_chunked(size_t step) {
+    HttpParser parser;
+    ReadBuffer buf;
+
+    parser.reset(true);
+
+    CHECK(feed(parser, buf,
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "Content-Encoding: gzip\r\n"
+        "\r\n"
+        "5\r\nhello\r\n"
+        "1;ext=1\r\n \r\n"
+        "A\r\n0123456789\r\n"
+        "0\r\n"
+        "Trailer: x\r\n"
+        "\r\n", step) == HttpParser::Result::DONE);
+
+    CHECK(parser.content_encoding() == HttpParser::Encoding::GZIP);
+    CHECK(body(parser, buf) == "hello 0123456789");
+    CHECK(parser.message_length() == buf.size());
+}
+
+static void test_body_received() {
+    HttpParser parser;
+    ReadBuffer buf;
+
+    parser.reset(true);
+
+    CHECK(feed(parser, buf,
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Length: 10\r\n"
+        "\r\n"
+        "abc", 1) == HttpParser::Result::NEED_MORE);
+
+    CHECK(parser.body_received(buf.size()) == 3);
+
+    parser.reset(true);
+    buf.clear();
+
+    CHECK(feed(parser, buf,
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n"
+        "3\r\nabc\r\n"
+        "5\r\nde", 1) == HttpParser::Result::NEED_MORE);
+
+    CHECK(parser.body_received(buf.size()) == 5);
+    CHECK(std::string((const char *)buf.data() + parser.body_start(), 5) == "abcde");
+}
+
+static void test_bad_chunk(size_t step) {
+    HttpParser parser;
+    ReadBuffer buf;
+
+    parser.reset(true);
+
+    CHECK(feed(parser, buf,
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n"
+        "2\r\nabc\r\n", step) == HttpParser::Result::ERROR);
+}
+
+static void test_bad_content_length(size_t step) {
+    for (const char *length: { "", "5x", "-1", "0x10", "99999999999999999999" }) {
+        HttpParser parser;
+        ReadBuffer buf;
+
+        parser.reset(true);
+
+        CHECK(feed(parser, buf,
+            std::string("HTTP/1.1 200 OK\r\n")
+            + "Content-Length: " + length + "\r\n"
+            "\r\n"
+            "hello", step) == HttpParser::Result::ERROR);
+    }
+
+    // The largest length that fits is still valid
+    HttpParser parser;
+    ReadBuffer buf;
+
+    parser.reset(true);
+
+    CHECK(feed(parser, buf,
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Length: 9223372036854775807\r\n"
+        "\r\n"
+        "hello", step) == HttpParser::Result::NEED_MORE);
+}
+
+static void test_interim(size_t step) {
+    HttpParser parser;
+    ReadBuffer buf;
+
+    parser.reset(true);
+
+    CHECK(feed(parser, buf,
+        "HTTP/1.1 100 Continue\r\n"
+        "\r\n"
+        "HTTP/1.1 102 Processing\r\n"
+        "Content-Length: 99\r\n"
+        "\r\n"
+        "HTTP/1.1 404 Not Found\r\n"
+        "Content-Length: 3\r\n"
+        "\r\n"
+        "abc", step) == HttpParser::Result::DONE);
+
+    CHECK(parser.status_code() == 404);
+    CHECK(body(parser, buf) == "abc");
+}
+
+static void test_pipelined(size_t step) {
+    HttpParser parser;
+    ReadBuffer buf;
+
+    std::string first =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Length: 3\r\n"
+        "\r\n"
+        "one";
+
+    std::string second =
+        "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n"
+        "3\r\ntwo\r\n0\r\n\r\n";
+
+    std::string third =
+        "HTTP/1.1 204 No Content\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+
+    // The first one is fed in steps, then the rest arrives in one read. Each one is consumed
+    // before the next is parsed, like the transport does.
+    std::string all = first + second + third;
+
+    parser.reset(true);
+
+    CHECK(feed(parser, buf, all, step) == HttpParser::Result::DONE);
+    CHECK(body(parser, buf) == "one");
+
+    size_t fed = buf.size();
+    memcpy(buf.prepare(all.size() - fed), all.data() + fed, all.size() - fed);
+    buf.commit(all.size() - fed);
+
+    buf.consume(parser.message_length());
+    parser.reset(true);
+
+    CHECK(parser.parse(buf.data(), buf.size()) == HttpParser::Result::DONE);
+    CHECK(body(parser, buf) == "two");
+
+    buf.consume(parser.message_length());
+    parser.reset(true);
+
+    CHECK(parser.parse(buf.data(), buf.size()) == HttpParser::Result::DONE);
+    CHECK(parser.status_code() == 204);
+    CHECK(parser.body_length() == 0);
+    CHECK(!parser.keep_alive());
+    CHECK(parser.message_length() == buf.size());
+}
+
+static void test_until_close(size_t step) {
+    HttpParser parser;
+    ReadBuffer buf;
+
+    parser.reset(true);
+
+    CHECK(feed(parser, buf,
+        "HTTP/1.0 200 OK\r\n"
+        "\r\n"
+        "everything until the end", step) == HttpParser::Result::NEED_MORE);
+
+    CHECK(!parser.keep_alive());
+    CHECK(parser.eof() == HttpParser::Result::DONE);
+    CHECK(body(parser, buf) == "everything until the end");
+}
+
+static void test_eof_too_early() {
+    HttpParser parser;
+    ReadBuffer buf;
+
+    parser.reset(true);
+
+    CHECK(feed(parser, buf,
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Length: 10\r\n"
+        "\r\n"
+        "short", 1) == HttpParser::Result::NEED_MORE);
+
+    CHECK(parser.eof() == HttpParser::Result::ERROR);
+}
+
+static void test_bad_status() {
+    HttpParser parser;
+    ReadBuffer buf;
+
+    parser.reset(true);
+
+    CHECK(feed(parser, buf, "SPDY/3 200 OK\r\n\r\n", 1) == HttpParser::Result::ERROR);
+}
+
+int main() {
+    // Whole responses at once, and one byte at a time to exercise resuming
+    for (size_t step: { (size_t)1, (size_t)7, (size_t)4096 }) {
+        test_content_length(step);
+        test_chunked(step);
+        test_bad_chunk(step);
+        test_bad_content_length(step);
+        test_interim(step);
+        test_pipelined(step);
+        test_until_close(step);
+    }
+
+    test_body_received();
+    test_eof_too_early();
+    test_bad_status();
+
+    return check_result("httpparser");
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+#include "../thrift_line/TalkService.h"
+
+// Operations and replies as the generated code writes them with TCompactProtocol, for checking the
+// views against
+
+static std::string buffer_contents(apache::thrift::transport::TMemoryBuffer &buffer) {
+    uint8_t *data;
+    uint32_t size;
+
+    buffer.getBuffer(&data, &size);
+
+    return std::string((const char *)data, size);
+}
+
+static line::Operation make_operation(int64_t revision, bool with_message,
+    line::ContentType::type content_type=line::ContentType::STICKER)
+{
+    line::Operation op;
+
+    op.revision = revision;
+    op.createdTime = 1400000000000 + revision;
+    op.type = with_message ? line::OpType::RECEIVE_MESSAGE : line::OpType::NOTIFIED_UPDATE_GROUP;
+    op.reqSeq = -1;
+    op.param1 = "c0123456789abcdef0123456789abcdef";
+    op.param2 = std::string("with\0null", 9);
+    op.param3 = "";
+
+    if (with_message) {
+        line::Message &msg = op.message;
+
+        msg.from_ = "u0123456789abcdef0123456789abcdef";
+        msg.to = "c0123456789abcdef0123456789abcdef";
+        msg.toType = line::MIDType::GROUP;
+        msg.id = "1234567890";
+        msg.createdTime = -5;
+        msg.text = "hello";
+        msg.contentType = content_type;
+        msg.contentPreview = std::string(300, '\x80');
+        msg.contentMetadata["STKID"] = "13";
+        msg.contentMetadata["STKPKGID"] = "1";
+
+        msg.location.title = "somewhere";
+        msg.location.address = "";
+        msg.location.latitude = 60.1699;
+        msg.location.longitude = -24.9384;
+        msg.location.__isset.title = true;
+        msg.location.__isset.address = true;
+        msg.location.__isset.latitude = true;
+        msg.location.__isset.longitude = true;
+
+        msg.__isset.from_ = true;
+        msg.__isset.to = true;
+        msg.__isset.toType = true;
+        msg.__isset.id = true;
+        msg.__isset.createdTime = true;
+        msg.__isset.text = true;
+        msg.__isset.location = true;
+        msg.__isset.contentType = true;
+        msg.__isset.contentPreview = true;
+        msg.__isset.contentMetadata = true;
+
+        op.__isset.message = true;
+    }
+
+    op.__isset.revision = true;
+    op.__isset.createdTime = true;
+    op.__isset.type = true;
+    op.__isset.reqSeq = true;
+    op.__isset.param1 = true;
+    op.__isset.param2 = true;
+    op.__isset.param3 = true;
+
+    return op;
+}
+
+static std::string fetch_operations_reply(const line::TalkService_fetchOperations_result &result) {
+    auto buffer = std::make_shared<apache::thrift::transport::TMemoryBuffer>();
+    apache::thrift::protocol::TCompactProtocol protocol(buffer);
+
+    protocol.writeMessageBegin("fetchOperations", apache::thrift::protocol::T_REPLY, 7);
+    result.write(&protocol);
+    protocol.writeMessageEnd();
+
+    return buffer_contents(*buffer);
+}
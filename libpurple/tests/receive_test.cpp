@@ -0,0 +1,112 @@
+#include <string>
+#include <vector>
+
+#include "../thriftview.hpp"
+
+#include "alloccount.hpp"
+#include "check.hpp"
+#include "operations.hpp"
+
+// Allocations made on the way from a poll response to the conversation, with the same steps the
+// poller takes: decode the batch into the arena, turn each message into a line::Message and move
+// it along to where it's written.
+
+static const size_t BATCH_SIZE = 50;
+
+static std::string make_batch() {
+    line::TalkService_fetchOperations_result result;
+
+    for (size_t i = 0; i < BATCH_SIZE; i++)
+        result.success.push_back(make_operation(1000 + i, i % 3 != 0));
+
+    result.__isset.success = true;
+
+    return fetch_operations_reply(result);
+}
+
+enum class Dispatch {
+    NONE,
+
+    // Convert each message and drop it
+    CONVERT,
+
+    // Convert each message, move it into a conversation's queue and from there to be written
+    DELIVER,
+};
+
+// Returns the number of allocations one round made
+static size_t run_round(const std::string &reply, Arena &arena, Dispatch dispatch,
+    std::vector<line::Message> &queue, std::vector<line::Message> &written)
+{
+    size_t before = alloc_count;
+
+    {
+        OperationList operations((ArenaAllocator<OperationView>(&arena)));
+
+        size_t used = decode_fetch_operations_reply((const uint8_t *)reply.data(), reply.size(),
+            operations);
+
+        CHECK(used == reply.size());
+        CHECK(operations.size() == BATCH_SIZE);
+
+        for (const OperationView &op : operations) {
+            if (dispatch == Dispatch::NONE || op.type != line::OpType::RECEIVE_MESSAGE)
+                continue;
+
+            line::Message msg;
+            op.message().to_message(msg);
+
+            if (dispatch == Dispatch::DELIVER)
+                queue.push_back(std::move(msg));
+        }
+
+        for (line::Message &msg : queue)
+            written.push_back(std::move(msg));
+    }
+
+    arena.reset();
+
+    size_t count = alloc_count - before;
+
+    queue.clear();
+    written.clear();
+
+    return count;
+}
+
+static void test_batch() {
+    std::string reply = make_batch();
+
+    Arena arena;
+    std::vector<line::Message> queue, written;
+
+    queue.reserve(BATCH_SIZE);
+    written.reserve(BATCH_SIZE);
+
+    // The first rounds grow the arena to fit the batch
+    for (int i = 0; i < 3; i++)
+        run_round(reply, arena, Dispatch::DELIVER, queue, written);
+
+    // Decoding a batch into the arena doesn't touch the heap
+    CHECK(run_round(reply, arena, Dispatch::NONE, queue, written) == 0);
+
+    // A message costs what its own strings and metadata need, and passing it along nothing more
+    size_t converted = run_round(reply, arena, Dispatch::CONVERT, queue, written);
+    size_t delivered = run_round(reply, arena, Dispatch::DELIVER, queue, written);
+
+    size_t messages = BATCH_SIZE - (BATCH_SIZE + 2) / 3;
+
+    CHECK(delivered == converted);
+    CHECK(converted <= messages * 6);
+}
+
+int main() {
+    // Make sure the hook is in place
+    size_t before = alloc_count;
+    std::string counted(100, 'x');
+    CHECK(alloc_count == before + 1);
+
+    test_batch();
+
+    return check_result("receive");
+}
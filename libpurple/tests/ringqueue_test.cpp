@@ -0,0 +1,66 @@
+#include <deque>
+#include <memory>
+
+#include "../ringqueue.hpp"
+
+#include "check.hpp"
+
+// Checks against std::deque with a move-only type, wrapping around and growing at both ends
+static void test_against_deque() {
+    RingQueue<std::unique_ptr<int>> queue;
+    std::deque<int> expected;
+
+    unsigned seed = 1;
+
+    for (int i = 0; i < 10000; i++) {
+        seed = seed * 1103515245 + 12345;
+        int op = (seed >> 16) % 4;
+
+        if (op == 0) {
+            queue.push_back(std::unique_ptr<int>(new int(i)));
+            expected.push_back(i);
+        } else if (op == 1) {
+            queue.push_front(std::unique_ptr<int>(new int(i)));
+            expected.push_front(i);
+        } else if (op == 2 && !expected.empty()) {
+            CHECK(*queue.front() == expected.front());
+            queue.pop_front();
+            expected.pop_front();
+        } else if (op == 3 && !expected.empty()) {
+            CHECK(*queue.back() == expected.back());
+            queue.pop_back();
+            expected.pop_back();
+        }
+
+        CHECK(queue.size() == expected.size());
+    }
+
+    for (size_t i = 0; i < expected.size(); i++)
+        CHECK(*queue[i] == expected[i]);
+}
+
+// Every element is destroyed exactly once, including ones left in the queue
+static void test_destroy() {
+    auto counter = std::make_shared<int>(0);
+
+    {
+        RingQueue<std::shared_ptr<int>> queue;
+
+        for (int i = 0; i < 100; i++)
+            queue.push_back(std::shared_ptr<int>(counter));
+
+        for (int i = 0; i < 50; i++)
+            queue.pop_front();
+
+        CHECK(counter.use_count() == 51);
+    }
+
+    CHECK(counter.use_count() == 1);
+}
+
+int main() {
+    test_against_deque();
+    test_destroy();
+
+    return check_result("ringqueue");
+}
@@ -0,0 +1,162 @@
+#include <string>
+
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "../snapshot.hpp"
+
+#include "check.hpp"
+
+static line::Snapshot make_snapshot(int64_t revision) {
+    line::Snapshot snapshot;
+
+    snapshot.revision = revision;
+    snapshot.savedTime = 1400000000;
+
+    snapshot.profile.mid = "u0123456789abcdef0123456789abcdef";
+    snapshot.profile.displayName = "Me";
+
+    for (int i = 0; i < 3; i++) {
+        line::Contact contact;
+
+        contact.mid = "u" + std::to_string(i) + "123456789abcdef0123456789abcdef";
+        contact.displayName = "Contact " + std::to_string(i);
+        contact.status = line::ContactStatus::FRIEND;
+
+        snapshot.contacts.push_back(contact);
+    }
+
+    line::Group group;
+    group.id = "c0123456789abcdef0123456789abcdef";
+    group.name = "Group";
+    group.members = snapshot.contacts;
+
+    snapshot.groups.push_back(group);
+
+    return snapshot;
+}
+
+static std::string read_file(const std::string &path) {
+    gchar *contents;
+    gsize length;
+
+    if (!g_file_get_contents(path.c_str(), &contents, &length, nullptr))
+        return "";
+
+    std::string data(contents, length);
+    g_free(contents);
+
+    return data;
+}
+
+static void write_file(const std::string &path, const std::string &data) {
+    CHECK(g_file_set_contents(path.c_str(), data.data(), data.size(), nullptr));
+}
+
+// Returns whether the snapshot at path loaded, and checks that a failure says why
+static bool loads(const std::string &path) {
+    line::Snapshot snapshot;
+    std::string error;
+
+    bool ok = AccountSnapshot::load(path, snapshot, error);
+
+    CHECK(ok == error.empty());
+
+    return ok;
+}
+
+static void test_round_trip(const std::string &path) {
+    line::Snapshot saved = make_snapshot(1000), loaded;
+    std::string error;
+
+    CHECK(AccountSnapshot::save(path, saved, error));
+    CHECK(AccountSnapshot::load(path, loaded, error));
+    CHECK(error.empty());
+    CHECK(loaded == saved);
+
+    // Only the user can read it
+    GStatBuf st;
+    CHECK(g_stat(path.c_str(), &st) == 0 && (st.st_mode & 0777) == 0600);
+
+    // Saving again replaces it, without leaving the temporary file behind
+    CHECK(AccountSnapshot::save(path, make_snapshot(2000), error));
+    CHECK(AccountSnapshot::load(path, loaded, error));
+    CHECK(loaded.revision == 2000);
+    CHECK(!g_file_test((path + ".save").c_str(), G_FILE_TEST_EXISTS));
+}
+
+static void test_missing(const std::string &path) {
+    line::Snapshot snapshot;
+    std::string error;
+
+    // Not having a snapshot isn't an error
+    CHECK(!AccountSnapshot::load(path, snapshot, error));
+    CHECK(error.empty());
+}
+
+static void test_truncated(const std::string &path) {
+    std::string error;
+    CHECK(AccountSnapshot::save(path, make_snapshot(1000), error));
+
+    std::string data = read_file(path);
+    CHECK(data.size() > 20);
+
+    for (size_t length: { (size_t)0, (size_t)4, (size_t)19, (size_t)20, data.size() - 1 }) {
+        write_file(path, data.substr(0, length));
+        CHECK(!loads(path));
+    }
+
+    // Anything after the end doesn't belong there either
+    write_file(path, data + "x");
+    CHECK(!loads(path));
+}
+
+static void test_corrupted(const std::string &path) {
+    std::string error;
+    CHECK(AccountSnapshot::save(path, make_snapshot(1000), error));
+
+    std::string data = read_file(path);
+
+    // Magic, version, checksum, length and somewhere in the payload
+    for (size_t pos: { (size_t)0, (size_t)4, (size_t)8, (size_t)12, data.size() / 2 }) {
+        std::string corrupted = data;
+        corrupted[pos] ^= 0x01;
+
+        write_file(path, corrupted);
+        CHECK(!loads(path));
+    }
+
+    // The original still loads
+    write_file(path, data);
+    CHECK(loads(path));
+}
+
+int main() {
+    gchar *dir = g_dir_make_tmp("snapshot_test-XXXXXX", nullptr);
+    if (!dir) {
+        fprintf(stderr, "snapshot_test: couldn't create a temporary directory\n");
+        return 1;
+    }
+
+    gchar *path_p = g_build_filename(dir, "line", "test.snapshot", nullptr);
+    std::string path(path_p);
+    g_free(path_p);
+
+    test_missing(path);
+    test_round_trip(path);
+    test_truncated(path);
+    test_corrupted(path);
+
+    g_unlink(path.c_str());
+
+    gchar *line_dir = g_path_get_dirname(path.c_str());
+    g_rmdir(line_dir);
+    g_free(line_dir);
+
+    g_rmdir(dir);
+    g_free(dir);
+
+    return check_result("snapshot");
+}
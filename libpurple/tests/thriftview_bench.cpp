@@ -0,0 +1,104 @@
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <stdio.h>
+
+#include "../thriftview.hpp"
+
+#include "operations.hpp"
+
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+
+// Time to decode a fetchOperations reply of 50 operations with the views, against the generated
+// code. Run with make bench.
+
+static const int RUNS = 20000;
+
+static size_t sink = 0;
+
+template <typename F>
+static void measure(const char *name, F run) {
+    for (int i = 0; i < RUNS / 10; i++)
+        run();
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < RUNS; i++)
+        run();
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+    printf("%-32s %10.0f ns per reply\n", name, elapsed.count() / RUNS);
+}
+
+int main() {
+    line::TalkService_fetchOperations_result result;
+
+    for (int i = 0; i < 50; i++) {
+        result.success.push_back(make_operation(1000 + i, i % 3 != 0,
+            (i % 6 == 1) ? line::ContentType::IMAGE : line::ContentType::STICKER));
+    }
+
+    result.__isset.success = true;
+
+    std::string reply = fetch_operations_reply(result);
+    const uint8_t *data = (const uint8_t *)reply.data();
+
+    printf("%d operations, %u bytes\n", (int)result.success.size(), (unsigned)reply.size());
+
+    Arena arena;
+
+    measure("views", [&]() {
+        {
+            OperationList operations((ArenaAllocator<OperationView>(&arena)));
+            decode_fetch_operations_reply(data, reply.size(), operations);
+
+            sink += operations.size();
+        }
+
+        arena.reset();
+    });
+
+    // What the poller does with messages
+    measure("views, messages to_message", [&]() {
+        {
+            OperationList operations((ArenaAllocator<OperationView>(&arena)));
+            decode_fetch_operations_reply(data, reply.size(), operations);
+
+            for (const OperationView &op : operations) {
+                if (!op.__isset.message)
+                    continue;
+
+                line::Message msg;
+                op.message().to_message(msg);
+
+                sink += msg.text.size();
+            }
+        }
+
+        arena.reset();
+    });
+
+    auto buffer = std::make_shared<TMemoryBuffer>();
+    TCompactProtocol protocol(buffer);
+
+    measure("generated", [&]() {
+        buffer->resetBuffer((uint8_t *)data, (uint32_t)reply.size());
+
+        std::string name;
+        apache::thrift::protocol::TMessageType type;
+        int32_t seqid;
+
+        line::TalkService_fetchOperations_result decoded;
+
+        protocol.readMessageBegin(name, type, seqid);
+        decoded.read(&protocol);
+        protocol.readMessageEnd();
+
+        sink += decoded.success.size();
+    });
+
+    return sink == 0;
+}
@@ -0,0 +1,159 @@
+#include <memory>
+#include <string>
+
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <thrift/transport/TTransportException.h>
+
+#include "../thriftview.hpp"
+
+#include "check.hpp"
+#include "operations.hpp"
+
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::transport::TTransportException;
+
+// What to_message is expected to make of msg, which leaves out previews that aren't shown
+static line::Message converted(const line::Message &msg) {
+    line::Message expected(msg);
+
+    if (msg.contentType != line::ContentType::IMAGE
+        && msg.contentType != line::ContentType::VIDEO)
+    {
+        expected.contentPreview.clear();
+        expected.__isset.contentPreview = false;
+    }
+
+    return expected;
+}
+
+static void check_message(const MessageView &view, const line::Message &msg) {
+    CHECK(view.from_ == msg.from_);
+    CHECK(view.to == msg.to);
+    CHECK(view.toType == msg.toType);
+    CHECK(view.id == msg.id);
+    CHECK(view.createdTime == msg.createdTime);
+    CHECK(view.text == msg.text);
+    CHECK(view.contentType == msg.contentType);
+    CHECK(view.content_preview() == msg.contentPreview);
+
+    CHECK(view.location.title == msg.location.title);
+    CHECK(view.location.address == msg.location.address);
+    CHECK(view.location.latitude == msg.location.latitude);
+    CHECK(view.location.longitude == msg.location.longitude);
+
+    CHECK(view.contentMetadata.size() == msg.contentMetadata.size());
+    for (auto &p: msg.contentMetadata)
+        CHECK(view.metadata(p.first.c_str()) == p.second);
+
+    CHECK(!view.has_metadata("missing"));
+
+    line::Message copy;
+    view.to_message(copy);
+
+    CHECK(copy == converted(msg));
+}
+
+static void check_operation(const OperationView &view, const line::Operation &op) {
+    CHECK(view.revision == op.revision);
+    CHECK(view.createdTime == op.createdTime);
+    CHECK(view.type == op.type);
+    CHECK(view.reqSeq == op.reqSeq);
+    CHECK(view.param1 == op.param1);
+    CHECK(view.param2 == op.param2);
+    CHECK(view.param3 == op.param3);
+    CHECK(view.__isset.message == op.__isset.message);
+
+    check_message(view.message(), op.message);
+
+    line::Operation copy;
+    view.to_operation(copy);
+
+    line::Operation expected(op);
+    expected.message = converted(op.message);
+
+    CHECK(copy == expected);
+}
+
+static void test_operation(bool with_message, line::ContentType::type content_type) {
+    line::Operation op = make_operation(42, with_message, content_type);
+
+    auto buffer = std::make_shared<TMemoryBuffer>();
+    TCompactProtocol protocol(buffer);
+    op.write(&protocol);
+
+    std::string data = buffer_contents(*buffer);
+
+    Arena arena;
+    OperationView view;
+
+    CHECK(view.decode((const uint8_t *)data.data(), data.size(), &arena) == data.size());
+    check_operation(view, op);
+}
+
+static void test_reply() {
+    line::TalkService_fetchOperations_result result;
+
+    for (int i = 0; i < 50; i++)
+        result.success.push_back(make_operation(1000 + i, i % 3 == 0));
+
+    result.__isset.success = true;
+
+    std::string data = fetch_operations_reply(result);
+
+    CHECK(is_success_reply((const uint8_t *)data.data(), data.size()));
+
+    Arena arena;
+    OperationList operations((ArenaAllocator<OperationView>(&arena)));
+
+    CHECK(decode_fetch_operations_reply((const uint8_t *)data.data(), data.size(), operations)
+        == data.size());
+
+    CHECK(operations.size() == result.success.size());
+    for (size_t i = 0; i < operations.size() && i < result.success.size(); i++)
+        check_operation(operations[i], result.success[i]);
+
+    // Cut short anywhere, the reply is either rejected or reported as corrupted
+    for (size_t len = 0; len < data.size(); len++) {
+        bool rejected;
+
+        try {
+            rejected = (decode_fetch_operations_reply((const uint8_t *)data.data(), len,
+                operations) == 0);
+        } catch (TTransportException &) {
+            rejected = true;
+        }
+
+        CHECK(rejected);
+    }
+}
+
+static void test_exception_reply() {
+    line::TalkService_fetchOperations_result result;
+
+    result.e.code = line::ErrorCode::INVALID_MID;
+    result.e.reason = "nope";
+    result.e.__isset.code = true;
+    result.e.__isset.reason = true;
+    result.__isset.e = true;
+
+    std::string data = fetch_operations_reply(result);
+
+    Arena arena;
+    OperationList operations((ArenaAllocator<OperationView>(&arena)));
+
+    CHECK(!is_success_reply((const uint8_t *)data.data(), data.size()));
+    CHECK(decode_fetch_operations_reply((const uint8_t *)data.data(), data.size(), operations)
+        == 0);
+}
+
+int main() {
+    test_operation(false, line::ContentType::NONE);
+    test_operation(true, line::ContentType::STICKER);
+    test_operation(true, line::ContentType::IMAGE);
+    test_reply();
+    test_exception_reply();
+
+    return check_result("thriftview");
+}
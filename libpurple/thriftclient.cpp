@@ -2,20 +2,55 @@
 #include <connection.h>
 
 #include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
 
 #include "constants.hpp"
 #include "thriftclient.hpp"
 
-ThriftClient::ThriftClient(PurpleAccount *acct, PurpleConnection *conn, std::string path)
+// Calls that only read can be sent again if the connection is lost before they're answered
+static bool is_idempotent(const std::string &method) {
+    return method.compare(0, 3, "get") == 0 || method.compare(0, 5, "fetch") == 0;
+}
+
+// A reply to method with a TalkException, so that a call that was given up on fails the same way
+// as when the server refuses it
+static std::string failure_reply(const std::string &method) {
+    auto buffer = std::make_shared<apache::thrift::transport::TMemoryBuffer>();
+    apache::thrift::protocol::TCompactProtocol protocol(buffer);
+
+    line::TalkException err;
+    err.code = line::ErrorCode::INTERNAL_ERROR;
+    err.reason = "Connection lost before the server answered, it may or may not have gone through.";
+    err.__isset.code = true;
+    err.__isset.reason = true;
+
+    protocol.writeMessageBegin(method, apache::thrift::protocol::T_REPLY, 0);
+    protocol.writeStructBegin("result");
+    protocol.writeFieldBegin("e", apache::thrift::protocol::T_STRUCT, 1);
+    err.write(&protocol);
+    protocol.writeFieldEnd();
+    protocol.writeFieldStop();
+    protocol.writeStructEnd();
+    protocol.writeMessageEnd();
+
+    return buffer->getBufferAsString();
+}
+
+ThriftClient::ThriftClient(PurpleAccount *acct, PurpleConnection *conn, const char *path,
+        size_t lanes)
     : line::TalkServiceClient(
         std::make_shared<apache::thrift::protocol::TCompactProtocol>(
-            std::make_shared<LineHttpTransport>(acct, conn, LINE_THRIFT_SERVER, 443, true))),
-    path(path)
+            std::make_shared<LineHttpPool>(acct, conn, LINE_THRIFT_SERVER, 443, true, lanes))),
+    path(path),
+    supervisor_(std::make_shared<RetrySupervisor>(path)),
+    tracer(nullptr)
 {
-    http = std::static_pointer_cast<LineHttpTransport>(getInputProtocol()->getTransport());
+    http = std::static_pointer_cast<LineHttpPool>(getInputProtocol()->getTransport());
+    http->set_supervisor(supervisor_);
+    http->set_compression(purple_account_get_bool(acct, LINE_ACCOUNT_COMPRESSION, TRUE));
 }
 
-void ThriftClient::set_path(std::string path) {
+void ThriftClient::set_path(const char *path) {
     this->path = path;
 }
 
@@ -23,8 +58,112 @@ void ThriftClient::set_auto_reconnect(bool auto_reconnect) {
     http->set_auto_reconnect(auto_reconnect);
 }
 
-void ThriftClient::send(std::function<void()> callback) {
-    http->request("POST", path, "application/x-thrift", callback);
+void ThriftClient::set_pipeline_depth(size_t depth) {
+    http->set_pipeline_depth(depth);
+}
+
+void ThriftClient::set_timeout(int seconds) {
+    http->set_timeout(seconds);
+}
+
+void ThriftClient::set_idle_timeout(int seconds) {
+    http->set_idle_timeout(seconds);
+}
+
+void ThriftClient::set_tracer(Tracer *tracer) {
+    this->tracer = tracer;
+}
+
+RequestHandle ThriftClient::send(Callback<void()> callback) {
+    return send(RequestPriority::NORMAL, std::string(), begin_call(), std::move(callback));
+}
+
+RequestHandle ThriftClient::send(RequestPriority priority, Callback<void()> callback) {
+    return send(priority, std::string(), begin_call(), std::move(callback));
+}
+
+// Calls sent with the same key are answered in the order they were sent, as long as they have the
+// same priority.
+RequestHandle ThriftClient::send(RequestPriority priority, const std::string &key,
+    Callback<void()> callback)
+{
+    return send(priority, key, begin_call(), std::move(callback));
+}
+
+RequestHandle ThriftClient::send(RequestPriority priority, const std::string &key,
+    CallIterator call, Callback<void()> callback)
+{
+    static_assert(ResponseCallback::stored_inline<CallCompletion>(),
+        "ResponseCallback is too small for CallCompletion");
+
+    return http->request(priority, key, "POST", path, "application/x-thrift",
+        is_idempotent(call->first), CallCompletion { this, call, std::move(callback) });
+}
+
+void ThriftClient::CallCompletion::operator()() {
+    LineHttpPool &http = *client->http;
+    Tracer *tracer = client->tracer;
+
+    if (http.failed())
+        http.substitute_body(failure_reply(call->first));
+
+    gint64 queue_time = http.queue_time();
+    gint64 wire_time = http.wire_time();
+
+    call->second.queue_time.add(queue_time);
+    call->second.wire_time.add(wire_time);
+
+    if (!tracer || !tracer->enabled()) {
+        callback();
+        return;
+    }
+
+    gint64 start = g_get_monotonic_time();
+
+    callback();
+
+    // Waiting to be sent and waiting for the response may overlap other calls. The callback,
+    // which decodes the response, runs on the main loop.
+    gint64 sent = start - wire_time;
+    tracer->async_span("queue", call->first, sent - queue_time, sent);
+    tracer->async_span("wire", call->first, sent, start);
+    tracer->span(Tracer::Track::MAIN, call->first, start, g_get_monotonic_time());
+}
+
+// Counts a call to the method in the request that was just written. The name is read from the
+// message header: protocol id, version and type, then the sequence number and the name length as
+// varints.
+ThriftClient::CallIterator ThriftClient::begin_call() {
+    const std::string &body = http->pending_request();
+
+    size_t pos = 2;
+    uint64_t values[2] = { 0, 0 };
+
+    for (int v = 0; v < 2; v++) {
+        for (int shift = 0; pos < body.size() && shift < 64; shift += 7) {
+            uint8_t b = (uint8_t)body[pos++];
+
+            values[v] |= (uint64_t)(b & 0x7f) << shift;
+
+            if (!(b & 0x80))
+                break;
+        }
+    }
+
+    // Assigned into a reused string and looked up before inserting, so that only the first call
+    // to each method allocates
+    if (pos + values[1] <= body.size())
+        call_name.assign(body, pos, values[1]);
+    else
+        call_name.assign("unknown");
+
+    CallIterator call = call_stats_.find(call_name);
+    if (call == call_stats_.end())
+        call = call_stats_.insert({ call_name, CallStats() }).first;
+
+    call->second.calls++;
+
+    return call;
 }
 
 int ThriftClient::status_code() {
@@ -35,6 +174,43 @@ void ThriftClient::close() {
     http->close();
 }
 
+void ThriftClient::recv_fetchOperations(OperationList &_return) {
+    _return = OperationList(OperationList::allocator_type(http->arena()));
+
+    uint32_t len = 1;
+    const uint8_t *data = http->borrow(nullptr, &len);
+
+    size_t used = 0;
+    if (data)
+        used = decode_fetch_operations_reply(data, len, _return);
+
+    if (used == 0) {
+        // Not a successful reply. Nothing has been consumed yet, so the generated code can read
+        // the exception from the start and throw it.
+        std::vector<line::Operation> operations;
+        line::TalkServiceClient::recv_fetchOperations(operations);
+
+        throw apache::thrift::TApplicationException("fetchOperations: Missing result.");
+    }
+
+    http->consume((uint32_t)used);
+}
+
+void ThriftClient::recv_fetchOperations_reply(std::string &reply) {
+    uint32_t len = 1;
+    const uint8_t *data = http->borrow(nullptr, &len);
+
+    if (!data || !is_success_reply(data, len)) {
+        std::vector<line::Operation> operations;
+        line::TalkServiceClient::recv_fetchOperations(operations);
+
+        throw apache::thrift::TApplicationException("fetchOperations: Missing result.");
+    }
+
+    reply.assign((const char *)data, len);
+    http->consume(len);
+}
+
 // Required for the single set<Contact> in the interface
 
 bool line::Contact::operator<(const Contact &other) const {
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <deque>
+#include <map>
 
 #include <debug.h>
 #include <plugin.h>
@@ -9,22 +10,78 @@
 
 #include "thrift_line/TalkService.h"
 
-#include "linehttptransport.hpp"
+#include "linehttppool.hpp"
+#include "thriftview.hpp"
+#include "tracer.hpp"
 
 class ThriftClient : public line::TalkServiceClient {
 
-    std::string path;
-    std::shared_ptr<LineHttpTransport> http;
+    // A string constant, see LineHttpTransport::request
+    const char *path;
+    std::shared_ptr<LineHttpPool> http;
+    std::shared_ptr<RetrySupervisor> supervisor_;
+
+    // By method name
+    std::map<std::string, CallStats> call_stats_;
+    using CallIterator = std::map<std::string, CallStats>::iterator;
+
+    // Method name of the call being sent, kept for its capacity
+    std::string call_name;
+
+    Tracer *tracer;
+
+    // Accounts for a call around its callback. A named type instead of a lambda so that the
+    // move-only callback can be moved into it.
+    struct CallCompletion {
+        ThriftClient *client;
+        CallIterator call;
+        Callback<void()> callback;
+
+        void operator()();
+    };
+
+    RequestHandle send(RequestPriority priority, const std::string &key, CallIterator call,
+        Callback<void()> callback);
+    CallIterator begin_call();
 
 public:
 
-    ThriftClient(PurpleAccount *acct, PurpleConnection *conn, std::string path);
+    ThriftClient(PurpleAccount *acct, PurpleConnection *conn, const char *path,
+        size_t lanes=1);
 
-    void set_path(std::string path);
+    void set_path(const char *path);
     void set_auto_reconnect(bool auto_reconnect);
-    void send(std::function<void()> callback);
+    void set_pipeline_depth(size_t depth);
+    void set_timeout(int seconds);
+    void set_idle_timeout(int seconds);
+    void set_tracer(Tracer *tracer);
+    RequestHandle send(Callback<void()> callback);
+    RequestHandle send(RequestPriority priority, Callback<void()> callback);
+    RequestHandle send(RequestPriority priority, const std::string &key,
+        Callback<void()> callback);
 
     int status_code();
     void close();
 
+    // Decodes operations as views into the response body, allocated from the response's arena.
+    // Only valid until the callback returns.
+    using line::TalkServiceClient::recv_fetchOperations;
+    void recv_fetchOperations(OperationList &_return);
+
+    // Copies a successful fetchOperations reply out of the response, to be decoded later with
+    // decode_fetch_operations_reply. Anything else is read as usual, which throws.
+    void recv_fetchOperations_reply(std::string &reply);
+
+    const std::map<std::string, CallStats> &call_stats() const { return call_stats_; }
+    TransportStats transport_stats() const { return http->stats(); }
+    size_t queue_size() const { return http->queue_size(); }
+    const RetrySupervisor &supervisor() const { return *supervisor_; }
+
+    // Response body bytes received compressed, and their size after decompressing
+    uint64_t compressed_bytes() const { return http->compressed_bytes(); }
+    uint64_t uncompressed_bytes() const { return http->uncompressed_bytes(); }
+
+    // Shared by all connections of this client
+    RetrySupervisor &supervisor() { return *supervisor_; }
+
 };
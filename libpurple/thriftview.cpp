@@ -0,0 +1,552 @@
+#include <cstring>
+
+#include <thrift/protocol/TProtocol.h>
+#include <thrift/transport/TTransportException.h>
+
+#include "thriftview.hpp"
+
+using apache::thrift::transport::TTransportException;
+
+// Type ids used by the compact protocol, which are not the same as TType
+enum CompactType {
+    CT_STOP = 0,
+    CT_BOOLEAN_TRUE = 1,
+    CT_BOOLEAN_FALSE = 2,
+    CT_BYTE = 3,
+    CT_I16 = 4,
+    CT_I32 = 5,
+    CT_I64 = 6,
+    CT_DOUBLE = 7,
+    CT_BINARY = 8,
+    CT_LIST = 9,
+    CT_SET = 10,
+    CT_MAP = 11,
+    CT_STRUCT = 12,
+};
+
+static const int MAX_DEPTH = 64;
+
+class CompactReader {
+
+    const uint8_t *start;
+    const uint8_t *pos;
+    const uint8_t *end;
+
+public:
+
+    CompactReader(const uint8_t *data, size_t size) : start(data), pos(data), end(data + size) { }
+
+    size_t offset() const { return pos - start; }
+    size_t remaining() const { return end - pos; }
+
+    void advance(size_t len) {
+        if (len > remaining())
+            fail();
+
+        pos += len;
+    }
+
+    [[noreturn]] void fail() {
+        throw TTransportException(TTransportException::CORRUPTED_DATA,
+            "Invalid compact protocol data.");
+    }
+
+    uint8_t read_byte() {
+        if (pos == end)
+            fail();
+
+        return *pos++;
+    }
+
+    uint64_t read_varint() {
+        uint64_t value = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = read_byte();
+
+            value |= (uint64_t)(b & 0x7f) << shift;
+
+            if (!(b & 0x80))
+                return value;
+        }
+
+        fail();
+    }
+
+    int64_t read_zigzag() {
+        uint64_t value = read_varint();
+
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+
+    double read_double() {
+        if (remaining() < 8)
+            fail();
+
+        // Little-endian on the wire
+        uint64_t bits = 0;
+        for (int i = 7; i >= 0; i--)
+            bits = (bits << 8) | pos[i];
+
+        pos += 8;
+
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    StringView read_binary() {
+        uint64_t size = read_varint();
+        if (size > remaining())
+            fail();
+
+        StringView view((const char *)pos, (size_t)size);
+        pos += size;
+        return view;
+    }
+
+    // Reads a field header. Returns false at the end of the struct. last_id is the previous
+    // field's id, which the header may be relative to.
+    bool read_field(int16_t &last_id, int16_t &id, uint8_t &type) {
+        uint8_t b = read_byte();
+
+        if (b == CT_STOP)
+            return false;
+
+        type = b & 0x0f;
+
+        if (b >> 4)
+            id = last_id + (b >> 4);
+        else
+            id = (int16_t)read_zigzag();
+
+        last_id = id;
+        return true;
+    }
+
+    // List and set headers have the size in the high nibble, or in a varint if it doesn't fit
+    uint64_t read_list(uint8_t &elem_type) {
+        uint8_t b = read_byte();
+
+        elem_type = b & 0x0f;
+
+        uint64_t size = b >> 4;
+        if (size == 15)
+            size = read_varint();
+
+        // Every element takes at least one byte
+        if (size > remaining())
+            fail();
+
+        return size;
+    }
+
+    uint64_t read_map(uint8_t &key_type, uint8_t &value_type) {
+        uint64_t size = read_varint();
+
+        key_type = value_type = CT_STOP;
+
+        if (size == 0)
+            return 0;
+
+        uint8_t b = read_byte();
+        key_type = b >> 4;
+        value_type = b & 0x0f;
+
+        if (size > remaining() / 2)
+            fail();
+
+        return size;
+    }
+
+    // Booleans are stored in the type of a field header, but take a byte in lists and maps
+    void skip(uint8_t type, bool in_field, int depth=0) {
+        if (depth > MAX_DEPTH)
+            fail();
+
+        switch (type) {
+            case CT_BOOLEAN_TRUE:
+            case CT_BOOLEAN_FALSE:
+                if (!in_field)
+                    read_byte();
+                break;
+
+            case CT_BYTE:
+                read_byte();
+                break;
+
+            case CT_I16:
+            case CT_I32:
+            case CT_I64:
+                read_varint();
+                break;
+
+            case CT_DOUBLE:
+                advance(8);
+                break;
+
+            case CT_BINARY:
+                read_binary();
+                break;
+
+            case CT_LIST:
+            case CT_SET:
+                {
+                    uint8_t elem_type;
+                    for (uint64_t size = read_list(elem_type); size > 0; size--)
+                        skip(elem_type, false, depth + 1);
+                }
+                break;
+
+            case CT_MAP:
+                {
+                    uint8_t key_type, value_type;
+                    for (uint64_t size = read_map(key_type, value_type); size > 0; size--) {
+                        skip(key_type, false, depth + 1);
+                        skip(value_type, false, depth + 1);
+                    }
+                }
+                break;
+
+            case CT_STRUCT:
+                {
+                    int16_t last_id = 0, id;
+                    uint8_t field_type;
+                    while (read_field(last_id, id, field_type))
+                        skip(field_type, true, depth + 1);
+                }
+                break;
+
+            default:
+                fail();
+        }
+    }
+
+    // Skips a struct and returns a view of it
+    StringView skip_struct() {
+        const uint8_t *struct_start = pos;
+
+        skip(CT_STRUCT, true);
+
+        return StringView((const char *)struct_start, pos - struct_start);
+    }
+
+};
+
+bool StringView::operator==(const char *other) const {
+    return strlen(other) == size && memcmp(data, other, size) == 0;
+}
+
+bool StringView::operator==(const std::string &other) const {
+    return other.size() == size && memcmp(data, other.data(), size) == 0;
+}
+
+bool StringView::operator==(const StringView &other) const {
+    return other.size == size && memcmp(data, other.data, size) == 0;
+}
+
+static void read_location(CompactReader &reader, LocationView &loc) {
+    int16_t last_id = 0, id;
+    uint8_t type;
+
+    while (reader.read_field(last_id, id, type)) {
+        if (id == 1 && type == CT_BINARY) {
+            loc.title = reader.read_binary();
+            loc.__isset.title = true;
+        } else if (id == 2 && type == CT_BINARY) {
+            loc.address = reader.read_binary();
+            loc.__isset.address = true;
+        } else if (id == 3 && type == CT_DOUBLE) {
+            loc.latitude = reader.read_double();
+            loc.__isset.latitude = true;
+        } else if (id == 4 && type == CT_DOUBLE) {
+            loc.longitude = reader.read_double();
+            loc.__isset.longitude = true;
+        } else {
+            reader.skip(type, true);
+        }
+    }
+}
+
+void LocationView::to_location(line::Location &loc) const {
+    loc.title = title.str();
+    loc.address = address.str();
+    loc.latitude = latitude;
+    loc.longitude = longitude;
+    loc.__isset = __isset;
+}
+
+MessageView::MessageView()
+    : toType((line::MIDType::type)0),
+    createdTime(0),
+    contentType((line::ContentType::type)0)
+{
+}
+
+size_t MessageView::decode(const uint8_t *data, size_t size, Arena *arena) {
+    CompactReader reader(data, size);
+
+    int16_t last_id = 0, id;
+    uint8_t type;
+
+    while (reader.read_field(last_id, id, type)) {
+        if (id == 1 && type == CT_BINARY) {
+            from_ = reader.read_binary();
+            __isset.from_ = true;
+        } else if (id == 2 && type == CT_BINARY) {
+            to = reader.read_binary();
+            __isset.to = true;
+        } else if (id == 3 && type == CT_I32) {
+            toType = (line::MIDType::type)reader.read_zigzag();
+            __isset.toType = true;
+        } else if (id == 4 && type == CT_BINARY) {
+            this->id = reader.read_binary();
+            __isset.id = true;
+        } else if (id == 5 && type == CT_I64) {
+            createdTime = reader.read_zigzag();
+            __isset.createdTime = true;
+        } else if (id == 10 && type == CT_BINARY) {
+            text = reader.read_binary();
+            __isset.text = true;
+        } else if (id == 11 && type == CT_STRUCT) {
+            read_location(reader, location);
+            __isset.location = true;
+        } else if (id == 15 && type == CT_I32) {
+            contentType = (line::ContentType::type)reader.read_zigzag();
+            __isset.contentType = true;
+        } else if (id == 17 && type == CT_BINARY) {
+            content_preview_ = reader.read_binary();
+            __isset.contentPreview = true;
+        } else if (id == 18 && type == CT_MAP) {
+            uint8_t key_type, value_type;
+            uint64_t count = reader.read_map(key_type, value_type);
+
+            contentMetadata = MetadataList(MetadataList::allocator_type(arena));
+
+            if (key_type == CT_BINARY && value_type == CT_BINARY) {
+                contentMetadata.reserve(count);
+
+                for (; count > 0; count--) {
+                    StringView key = reader.read_binary();
+                    contentMetadata.emplace_back(key, reader.read_binary());
+                }
+            } else {
+                for (; count > 0; count--) {
+                    reader.skip(key_type, false);
+                    reader.skip(value_type, false);
+                }
+            }
+
+            __isset.contentMetadata = true;
+        } else {
+            reader.skip(type, true);
+        }
+    }
+
+    return reader.offset();
+}
+
+StringView MessageView::metadata(const char *key) const {
+    for (auto &p: contentMetadata) {
+        if (p.first == key)
+            return p.second;
+    }
+
+    return StringView();
+}
+
+bool MessageView::has_metadata(const char *key) const {
+    for (auto &p: contentMetadata) {
+        if (p.first == key)
+            return true;
+    }
+
+    return false;
+}
+
+void MessageView::to_message(line::Message &msg) const {
+    msg.from_ = from_.str();
+    msg.to = to.str();
+    msg.toType = toType;
+    msg.id = id.str();
+    msg.createdTime = createdTime;
+    msg.text = text.str();
+    location.to_location(msg.location);
+    msg.contentType = contentType;
+
+    msg.contentMetadata.clear();
+    for (auto &p: contentMetadata)
+        msg.contentMetadata[p.first.str()] = p.second.str();
+
+    msg.__isset = __isset;
+
+    if (shows_preview()) {
+        msg.contentPreview = content_preview_.str();
+    } else {
+        msg.contentPreview.clear();
+        msg.__isset.contentPreview = false;
+    }
+}
+
+OperationView::OperationView()
+    : arena(nullptr),
+    message_decoded(false),
+    revision(0),
+    createdTime(0),
+    type((line::OpType::type)0),
+    reqSeq(0)
+{
+}
+
+size_t OperationView::decode(const uint8_t *data, size_t size, Arena *arena) {
+    CompactReader reader(data, size);
+
+    this->arena = arena;
+
+    int16_t last_id = 0, id;
+    uint8_t type;
+
+    while (reader.read_field(last_id, id, type)) {
+        if (id == 1 && type == CT_I64) {
+            revision = reader.read_zigzag();
+            __isset.revision = true;
+        } else if (id == 2 && type == CT_I64) {
+            createdTime = reader.read_zigzag();
+            __isset.createdTime = true;
+        } else if (id == 3 && type == CT_I32) {
+            this->type = (line::OpType::type)reader.read_zigzag();
+            __isset.type = true;
+        } else if (id == 4 && type == CT_I32) {
+            reqSeq = (int32_t)reader.read_zigzag();
+            __isset.reqSeq = true;
+        } else if (id == 10 && type == CT_BINARY) {
+            param1 = reader.read_binary();
+            __isset.param1 = true;
+        } else if (id == 11 && type == CT_BINARY) {
+            param2 = reader.read_binary();
+            __isset.param2 = true;
+        } else if (id == 12 && type == CT_BINARY) {
+            param3 = reader.read_binary();
+            __isset.param3 = true;
+        } else if (id == 20 && type == CT_STRUCT) {
+            // Skipping checks that the whole struct is there, so decoding it later can't run off
+            // the end.
+            message_data = reader.skip_struct();
+            __isset.message = true;
+        } else {
+            reader.skip(type, true);
+        }
+    }
+
+    return reader.offset();
+}
+
+const MessageView &OperationView::message() const {
+    if (!message_decoded) {
+        if (!message_data.empty())
+            message_.decode((const uint8_t *)message_data.data, message_data.size, arena);
+
+        message_decoded = true;
+    }
+
+    return message_;
+}
+
+void OperationView::to_operation(line::Operation &op) const {
+    op.revision = revision;
+    op.createdTime = createdTime;
+    op.type = type;
+    op.reqSeq = reqSeq;
+    op.param1 = param1.str();
+    op.param2 = param2.str();
+    op.param3 = param3.str();
+    message().to_message(op.message);
+    op.__isset = __isset;
+}
+
+bool is_success_reply(const uint8_t *data, size_t size) {
+    CompactReader reader(data, size);
+
+    try {
+        if (reader.read_byte() != 0x82)
+            return false;
+
+        uint8_t version_type = reader.read_byte();
+        if ((version_type & 0x1f) != 1
+            || (version_type >> 5) != apache::thrift::protocol::T_REPLY)
+        {
+            return false;
+        }
+
+        reader.read_varint();
+        reader.read_binary();
+
+        // Result structs have the return value as field 0 and exceptions after it
+        int16_t last_id = 0, id;
+        uint8_t type;
+
+        return reader.read_field(last_id, id, type) && id == 0;
+    } catch (TTransportException &) {
+        return false;
+    }
+}
+
+size_t decode_fetch_operations_reply(const uint8_t *data, size_t size,
+    OperationList &operations)
+{
+    CompactReader reader(data, size);
+
+    operations.clear();
+
+    // Message header: protocol id, version and type, sequence number and method name
+    if (reader.read_byte() != 0x82)
+        return 0;
+
+    uint8_t version_type = reader.read_byte();
+    if ((version_type & 0x1f) != 1
+        || (version_type >> 5) != apache::thrift::protocol::T_REPLY)
+    {
+        return 0;
+    }
+
+    reader.read_varint();
+
+    if (!(reader.read_binary() == "fetchOperations"))
+        return 0;
+
+    // Result struct: success is field 0, a TalkException is field 1
+    bool success = false;
+    int16_t last_id = 0, id;
+    uint8_t type;
+
+    while (reader.read_field(last_id, id, type)) {
+        if (id == 0 && type == CT_LIST) {
+            uint8_t elem_type;
+            uint64_t count = reader.read_list(elem_type);
+
+            if (elem_type != CT_STRUCT)
+                return 0;
+
+            operations.resize(count);
+
+            for (OperationView &op: operations) {
+                size_t offset = reader.offset();
+
+                reader.advance(op.decode(data + offset, size - offset,
+                    operations.get_allocator().arena));
+            }
+
+            success = true;
+        } else if (id == 1) {
+            operations.clear();
+            return 0;
+        } else {
+            reader.skip(type, true);
+        }
+    }
+
+    if (!success)
+        return 0;
+
+    return reader.offset();
+}
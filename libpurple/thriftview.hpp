@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "thrift_line/TalkService.h"
+
+#include "arena.hpp"
+
+// Views into a compact protocol encoded buffer, for decoding large responses without copying every
+// string. The views do not own any data and are only valid as long as the buffer they were decoded
+// from, which for a response means until its callback returns. Use to_message/to_operation to get
+// owned copies of anything that has to outlive that. The containers in them are allocated from the
+// same response's arena, if one is given.
+
+class StringView {
+
+public:
+
+    const char *data;
+    size_t size;
+
+    StringView() : data(nullptr), size(0) { }
+    StringView(const char *data, size_t size) : data(data), size(size) { }
+
+    bool empty() const { return size == 0; }
+    std::string str() const { return std::string(data, size); }
+
+    bool operator==(const char *other) const;
+    bool operator==(const std::string &other) const;
+    bool operator==(const StringView &other) const;
+
+};
+
+class LocationView {
+
+public:
+
+    StringView title;
+    StringView address;
+    double latitude;
+    double longitude;
+    line::_Location__isset __isset;
+
+    LocationView() : latitude(0), longitude(0) { }
+
+    void to_location(line::Location &loc) const;
+
+};
+
+using MetadataList = std::vector<std::pair<StringView, StringView>,
+    ArenaAllocator<std::pair<StringView, StringView>>>;
+
+class MessageView {
+
+    StringView content_preview_;
+
+public:
+
+    StringView from_;
+    StringView to;
+    line::MIDType::type toType;
+    StringView id;
+    int64_t createdTime;
+    StringView text;
+    LocationView location;
+    line::ContentType::type contentType;
+    MetadataList contentMetadata;
+    line::_Message__isset __isset;
+
+    MessageView();
+
+    // Decodes a struct from the start of data and returns its length
+    size_t decode(const uint8_t *data, size_t size, Arena *arena=nullptr);
+
+    // The preview image is only copied if asked for
+    StringView content_preview() const { return content_preview_; }
+
+    // Only image and video messages are displayed with their preview
+    bool shows_preview() const {
+        return contentType == line::ContentType::IMAGE || contentType == line::ContentType::VIDEO;
+    }
+
+    // Empty if the key is not present
+    StringView metadata(const char *key) const;
+    bool has_metadata(const char *key) const;
+
+    // Leaves out the preview of messages that aren't displayed with one, as it's the largest part
+    void to_message(line::Message &msg) const;
+
+};
+
+class OperationView {
+
+    // The message is only decoded when it's accessed, as most operation types don't carry one.
+    StringView message_data;
+    Arena *arena;
+    mutable bool message_decoded;
+    mutable MessageView message_;
+
+public:
+
+    int64_t revision;
+    int64_t createdTime;
+    line::OpType::type type;
+    int32_t reqSeq;
+    StringView param1;
+    StringView param2;
+    StringView param3;
+    line::_Operation__isset __isset;
+
+    OperationView();
+
+    size_t decode(const uint8_t *data, size_t size, Arena *arena=nullptr);
+
+    const MessageView &message() const;
+
+    void to_operation(line::Operation &op) const;
+
+};
+
+using OperationList = std::vector<OperationView, ArenaAllocator<OperationView>>;
+
+// Decodes a fetchOperations reply into operations, which is allocated with its own allocator.
+// Returns the number of bytes used, or 0 if the reply is not a successful one, in which case the
+// generated decoder should be used to read the exception.
+size_t decode_fetch_operations_reply(const uint8_t *data, size_t size,
+    OperationList &operations);
+
+// Whether a reply message is a successful one, judging by its header and first field only
+bool is_success_reply(const uint8_t *data, size_t size);
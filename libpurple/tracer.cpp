@@ -0,0 +1,135 @@
+#include <debug.h>
+
+#include "json_decode.hpp"
+#include "tracer.hpp"
+
+Tracer::Tracer() :
+    file(nullptr),
+    unflushed(0),
+    origin(0),
+    next_id(1),
+    stage_start(0)
+{
+}
+
+Tracer::~Tracer() {
+    close();
+}
+
+void Tracer::open(std::string path) {
+    close();
+
+    file = fopen(path.c_str(), "w");
+    if (!file) {
+        purple_debug_warning("line", "Couldn't open trace file %s\n", path.c_str());
+        return;
+    }
+
+    origin = g_get_monotonic_time();
+
+    fputs("[\n", file);
+
+    const char *track_names[] = { nullptr, "Main loop", "Login" };
+
+    for (int tid = 1; tid <= 2; tid++) {
+        nlohmann::json event = {
+            { "name", "thread_name" },
+            { "ph", "M" },
+            { "pid", 1 },
+            { "tid", tid },
+            { "args", { { "name", track_names[tid] } } },
+        };
+
+        write(event.dump());
+    }
+}
+
+void Tracer::close() {
+    if (!file)
+        return;
+
+    stage(nullptr);
+
+    // Ends the array without a trailing comma
+    nlohmann::json event = {
+        { "name", "process_name" },
+        { "ph", "M" },
+        { "pid", 1 },
+        { "args", { { "name", "purple-line" } } },
+    };
+
+    fprintf(file, "%s\n]\n", event.dump().c_str());
+    fclose(file);
+
+    file = nullptr;
+}
+
+void Tracer::write(const std::string &event) {
+    fputs(event.c_str(), file);
+    fputs(",\n", file);
+
+    if (++unflushed >= 64) {
+        fflush(file);
+        unflushed = 0;
+    }
+}
+
+void Tracer::span(Track track, const std::string &name, gint64 start, gint64 end,
+    const Args &args)
+{
+    if (!file)
+        return;
+
+    nlohmann::json event = {
+        { "name", name },
+        { "ph", "X" },
+        { "pid", 1 },
+        { "tid", (int)track },
+        { "ts", start - origin },
+        { "dur", end - start },
+    };
+
+    if (!args.empty())
+        event["args"] = args;
+
+    write(event.dump());
+}
+
+void Tracer::async_span(const char *category, const std::string &name, gint64 start, gint64 end) {
+    if (!file)
+        return;
+
+    uint64_t id = next_id++;
+
+    nlohmann::json event = {
+        { "name", name },
+        { "cat", category },
+        { "ph", "b" },
+        { "id", id },
+        { "pid", 1 },
+        { "ts", start - origin },
+    };
+
+    write(event.dump());
+
+    event["ph"] = "e";
+    event["ts"] = end - origin;
+
+    write(event.dump());
+}
+
+void Tracer::stage(const char *name) {
+    if (!file)
+        return;
+
+    gint64 now = g_get_monotonic_time();
+
+    if (stage_name != "")
+        span(Track::LOGIN, stage_name, stage_start, now);
+
+    stage_name = name ? name : "";
+    stage_start = now;
+
+    if (!name)
+        fflush(file);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <glib.h>
+
+// Records spans in the Chrome trace event format, which can be loaded in Perfetto or
+// chrome://tracing. Events are appended to the file as they happen, using the JSON array form
+// which doesn't need to be closed, so a trace from a crashed or killed process is still readable.
+class Tracer {
+
+    FILE *file;
+    int unflushed;
+    gint64 origin;
+    uint64_t next_id;
+
+    std::string stage_name;
+    gint64 stage_start;
+
+    void write(const std::string &event);
+
+public:
+
+    // Callbacks and other work on the main loop, and the login stages
+    enum class Track {
+        MAIN = 1,
+        LOGIN = 2,
+    };
+
+    using Args = std::map<std::string, int64_t>;
+
+    Tracer();
+    ~Tracer();
+
+    void open(std::string path);
+    void close();
+
+    bool enabled() const { return file != nullptr; }
+
+    // Times are from g_get_monotonic_time(). Spans on one track must nest.
+    void span(Track track, const std::string &name, gint64 start, gint64 end,
+        const Args &args=Args());
+
+    // A span that may overlap with others, e.g. a request waiting for its response
+    void async_span(const char *category, const std::string &name, gint64 start, gint64 end);
+
+    // Ends the current login stage, if any, and starts a new one unless name is null
+    void stage(const char *name);
+
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "callback.hpp"
+
+// Joins independent asynchronous calls, so that they can all be started at once instead of each
+// one from the callback of the one before it. Wrap each call's callback with add(), then give the
+// continuation to then(). It runs once, after every wrapped callback has run, even if they all ran
+// before then() was called.
+//
+//     WhenAll all;
+//     group_cache.get(group_id, all.add([state](line::Group &group) { ... }));
+//     contact_cache.get(mid, all.add([state](line::Contact &contact) { ... }));
+//     all.then([this, state]() { ... });
+//
+// The continuation never runs if one of the calls never calls back, e.g. because the connection
+// was closed.
+class WhenAll {
+
+    struct State {
+        size_t pending;
+        Callback<void()> done;
+
+        State() : pending(0) { }
+
+        void complete() {
+            if (--pending == 0 && done) {
+                Callback<void()> call = std::move(done);
+                call();
+            }
+        }
+    };
+
+    template <typename F>
+    struct Step {
+        F f;
+        std::shared_ptr<State> state;
+
+        template <typename... Args>
+        void operator()(Args &&... args) {
+            f(std::forward<Args>(args)...);
+            state->complete();
+        }
+    };
+
+    std::shared_ptr<State> state;
+
+public:
+
+    WhenAll() : state(std::make_shared<State>()) { }
+
+    template <typename F>
+    Step<typename std::decay<F>::type> add(F &&f) {
+        state->pending++;
+
+        return Step<typename std::decay<F>::type> { std::forward<F>(f), state };
+    }
+
+    void then(Callback<void()> done) {
+        if (state->pending == 0) {
+            done();
+            return;
+        }
+
+        state->done = std::move(done);
+    }
+
+};